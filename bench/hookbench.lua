@@ -0,0 +1,66 @@
+-- hook开销的微基准：同一段调用循环分别在不开profile和trace模式下跑，
+-- 差值除以事件数(每次调用一个call一个ret)得到每个事件的纳秒数，取多轮中位数。
+-- 在仓库根目录编出lprofile_c.so后运行：
+--   LUA_CPATH="./?.so" lua bench/hookbench.lua [calls] [rounds]
+local lp = require "lprofile_c"
+
+local CALLS = tonumber(arg and arg[1]) or 2000000
+local ROUNDS = tonumber(arg and arg[2]) or 7
+
+local function leaf(x)
+    return x
+end
+
+local function loop(n)
+    local f = leaf
+    for i = 1, n do
+        f(i)
+    end
+end
+
+local clock = os.clock
+
+local function median(t)
+    table.sort(t)
+    return t[(#t + 1) // 2]
+end
+
+local function run(profile, setup)
+    local spans = {}
+    for r = 1, ROUNDS do
+        collectgarbage()
+        collectgarbage("stop")
+        if profile then
+            if setup then
+                setup()
+            end
+            lp.pbegin()
+        end
+        local t = clock()
+        loop(CALLS)
+        t = clock() - t
+        if profile then
+            lp.pend()
+            lp.pclear()
+        end
+        collectgarbage("restart")
+        spans[r] = t
+    end
+    return median(spans)
+end
+
+local cases = {
+    {"trace"},
+}
+
+-- 有pcapturename的版本再比一下关掉调用点名字解析，看新记录的元数据开销
+if lp.pcapturename then
+    cases[#cases + 1] = {"trace,capturename=false", function() lp.pcapturename(false) end}
+end
+
+local plain = run(false)
+print(string.format("%-28s %10.1f ms", "plain", plain * 1e3))
+for _, case in ipairs(cases) do
+    local span = run(true, case[2])
+    print(string.format("%-28s %10.1f ms  %6.1f ns/event", case[1], span * 1e3, (span - plain) * 1e9 / (CALLS * 2)))
+end
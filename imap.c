@@ -1,52 +1,301 @@
 #include "imap.h"
-#include <lauxlib.h>
-#include <stdlib.h>
+#include <string.h>
 
-#define IMAP_LUA_KEYNAME "_IK_"
+#define IMAP_INIT_CAP 16
 
-static size_t hashcb(const void *val){
-    return (size_t)val;
+/* 指针的低位总是0，默认用斐波那契乘法把高位混进来，取结果的高位做下标 */
+static inline size_t imap_slot(ImapContext *mc, uint64_t key){
+    switch(mc->hash){
+        case IMAP_HASH_IDENTITY:
+            return (size_t)key & mc->mask;
+        case IMAP_HASH_MURMUR:
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            key ^= key >> 33;
+            key *= 0xc4ceb9fe1a85ec53ull;
+            key ^= key >> 33;
+            return (size_t)key & mc->mask;
+        default:
+            return (size_t)((key * 11400714819323198485ull) >> mc->shift);
+    }
 }
 
-static int cmpcb(const void *x, const void *y){
-    uint64_t x_ = (uint64_t)x;
-    uint64_t y_ = (uint64_t)y;
+static bool imap_resize(ImapContext *mc, size_t cap){
+    ImapSlot *old = mc->slots;
+    ImapSlot *slots;
+    size_t oldcap = mc->cap;
+    int shift = 64;
+
+    for(size_t c = cap; c > 1; c >>= 1){
+        --shift;
+    }
+
+    /* 分配失败时保留旧表，调用者自己决定还能不能插 */
+    slots = mc->af(mc->ud, NULL, 0, cap * sizeof(slots[0]));
+    if(!slots){
+        return false;
+    }
+
+    memset(slots, 0, cap * sizeof(slots[0]));
+    mc->slots = slots;
+    mc->cap = cap;
+    mc->mask = cap - 1;
+    mc->shift = shift;
+
+    for(size_t i = 0; i < oldcap; ++i){
+        if(old[i].key){
+            size_t idx = imap_slot(mc, old[i].key);
+            while(mc->slots[idx].key){
+                idx = (idx + 1) & mc->mask;
+            }
+            mc->slots[idx] = old[i];
+        }
+    }
+
+    if(old){
+        mc->af(mc->ud, old, oldcap * sizeof(old[0]), 0);
+    }
+
+    return true;
+}
 
-    return x_ == y_ ? 0 : ( x_ < y_ ? -1 : 1 );
+static void imap_reset(ImapContext *mc){
+    mc->slots = NULL;
+    mc->cap = 0;
+    mc->mask = 0;
+    mc->count = 0;
+    mc->shift = 64;
+    mc->hash = IMAP_HASH_FIBONACCI;
+    mc->haszero = false;
+    mc->zeroval = NULL;
 }
 
-void imap_init(ImapContext *mc){
-    avl_map_init(&mc->table, hashcb, cmpcb);
+void imap_init(ImapContext *mc, ImapAlloc af, void *ud){
+    imap_reset(mc);
+    mc->af = af;
+    mc->ud = ud;
 }
 
 void imap_destroy(ImapContext *mc){
-    avl_map_destroy(&mc->table);
+    int hash = mc->hash;
+
+    if(mc->slots){
+        mc->af(mc->ud, mc->slots, mc->cap * sizeof(mc->slots[0]), 0);
+    }
+
+    imap_reset(mc);
+    mc->hash = hash;
 }
 
-void imap_set(ImapContext *mc, uint64_t key, void *val){
-    avl_map_set(&mc->table, (void *)key, (void *)val);
+/* 扩容失败且已经放不下新key时返回false，此时表保持原样，已有的key照常更新 */
+bool imap_set(ImapContext *mc, uint64_t key, void *val){
+    size_t idx;
+    bool room = true;
+
+    if(!key){
+        mc->count += mc->haszero ? 0 : 1;
+        mc->haszero = true;
+        mc->zeroval = val;
+        return true;
+    }
+
+    /* 负载超过1/2就扩容，保持探测链短 */
+    if((mc->count + 1) * 2 > mc->cap){
+        room = imap_resize(mc, mc->cap ? mc->cap * 2 : IMAP_INIT_CAP) || mc->count + 1 < mc->cap;
+    }
+
+    if(!mc->slots){
+        return false;
+    }
+
+    idx = imap_slot(mc, key);
+    while(mc->slots[idx].key){
+        if(mc->slots[idx].key == key){
+            mc->slots[idx].val = val;
+            return true;
+        }
+        idx = (idx + 1) & mc->mask;
+    }
+
+    if(!room){
+        return false;
+    }
+
+    mc->slots[idx].key = key;
+    mc->slots[idx].val = val;
+    ++mc->count;
+    return true;
 }
 
 bool imap_get(ImapContext *mc, uint64_t key, void **out){
-    struct avl_hash_entry *e = avl_map_find(&mc->table, (void *)key);
+    size_t idx;
+
+    if(!key){
+        return mc->haszero ? (*out = mc->zeroval, true) : false;
+    }
+
+    if(!mc->cap){
+        return false;
+    }
 
-    return e ? (*out = e->value, true) : false;
+    idx = imap_slot(mc, key);
+    while(mc->slots[idx].key){
+        if(mc->slots[idx].key == key){
+            *out = mc->slots[idx].val;
+            return true;
+        }
+        idx = (idx + 1) & mc->mask;
+    }
+
+    return false;
 }
 
+/* 线性探测删除时把后面同一条链上的元素往回挪，不留墓碑 */
 void imap_remove(ImapContext *mc, uint64_t key){
-    avl_map_remove(&mc->table, (void *)key);
+    size_t idx;
+    size_t next;
+
+    if(!key){
+        mc->count -= mc->haszero ? 1 : 0;
+        mc->haszero = false;
+        mc->zeroval = NULL;
+        return;
+    }
+
+    if(!mc->cap){
+        return;
+    }
+
+    idx = imap_slot(mc, key);
+    while(mc->slots[idx].key != key){
+        if(!mc->slots[idx].key){
+            return;
+        }
+        idx = (idx + 1) & mc->mask;
+    }
+
+    next = idx;
+    for(;;){
+        size_t home;
+
+        next = (next + 1) & mc->mask;
+        if(!mc->slots[next].key){
+            break;
+        }
+
+        home = imap_slot(mc, mc->slots[next].key);
+        /* home不在(idx, next]之间的才能挪到idx */
+        if((next > idx && (home <= idx || home > next)) || (next < idx && (home <= idx && home > next))){
+            mc->slots[idx] = mc->slots[next];
+            idx = next;
+        }
+    }
+
+    mc->slots[idx].key = 0;
+    mc->slots[idx].val = NULL;
+    --mc->count;
 }
 
 void imap_clear(ImapContext *mc){
-    avl_map_clear(&mc->table);
+    if(mc->cap){
+        memset(mc->slots, 0, mc->cap * sizeof(mc->slots[0]));
+    }
+
+    mc->count = 0;
+    mc->haszero = false;
+    mc->zeroval = NULL;
 }
 
-void imap_foreach(ImapContext *mc, ImapForeachCb cb, void *ud){
-    struct avl_hash_entry *e;
+/* 预留到能放下count个key而不再扩容，分配失败返回false */
+bool imap_reserve(ImapContext *mc, size_t count){
+    size_t cap = mc->cap ? mc->cap : IMAP_INIT_CAP;
+
+    while(count * 2 > cap){
+        cap *= 2;
+    }
+
+    return cap <= mc->cap || imap_resize(mc, cap);
+}
+
+/* 按当前key数缩到最小的容量，空表直接释放槽数组 */
+void imap_trim(ImapContext *mc){
+    size_t cap = IMAP_INIT_CAP;
+
+    if(!mc->cap){
+        return;
+    }
+
+    if(mc->count - (mc->haszero ? 1 : 0) == 0){
+        mc->af(mc->ud, mc->slots, mc->cap * sizeof(mc->slots[0]), 0);
+        mc->slots = NULL;
+        mc->cap = 0;
+        mc->mask = 0;
+        mc->shift = 64;
+        return;
+    }
+
+    while(mc->count * 2 > cap){
+        cap *= 2;
+    }
 
-    for(e = avl_map_first(&mc->table); e != NULL; e = avl_map_next(&mc->table, e)){
-        cb(ud, (uint64_t)e->node.key, e->value);
+    if(cap < mc->cap){
+        imap_resize(mc, cap);
     }
 }
 
+size_t imap_count(ImapContext *mc){
+    return mc->count;
+}
+
+/* 换hash函数后按原容量重新放一遍 */
+void imap_sethash(ImapContext *mc, int hash){
+    int old;
+
+    if(hash == mc->hash){
+        return;
+    }
+
+    old = mc->hash;
+
+    mc->hash = hash;
+    if(mc->cap && !imap_resize(mc, mc->cap)){
+        mc->hash = old;
+    }
+}
+
+void imap_stats(ImapContext *mc, ImapStats *out){
+    memset(out, 0, sizeof(out[0]));
+    out->cap = mc->cap;
+    out->count = mc->count;
+    out->bytes = mc->cap * sizeof(mc->slots[0]);
+
+    for(size_t i = 0; i < mc->cap; ++i){
+        size_t probe;
+        int bucket = 0;
+
+        if(!mc->slots[i].key){
+            continue;
+        }
+
+        probe = ((i - imap_slot(mc, mc->slots[i].key)) & mc->mask) + 1;
+        out->maxprobe = probe > out->maxprobe ? probe : out->maxprobe;
+
+        while((probe >>= 1) && bucket < IMAP_PROBEHIST_NB - 1){
+            ++bucket;
+        }
+        ++out->probehist[bucket];
+    }
+}
+
+void imap_foreach(ImapContext *mc, ImapForeachCb cb, void *ud){
+    if(mc->haszero){
+        cb(ud, 0, mc->zeroval);
+    }
+
+    for(size_t i = 0; i < mc->cap; ++i){
+        if(mc->slots[i].key){
+            cb(ud, mc->slots[i].key, mc->slots[i].val);
+        }
+    }
+}
 
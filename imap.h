@@ -1,21 +1,64 @@
+
 #ifndef __IMAP_H__
 #define __IMAP_H__
 
 #include <stdint.h>
 #include <stdbool.h>
-#include "avlhash.h"
+#include <stddef.h>
+
+/* 可选的hash混合函数，identity只用来对比分布问题 */
+enum {
+    IMAP_HASH_FIBONACCI,
+    IMAP_HASH_MURMUR,
+    IMAP_HASH_IDENTITY,
+    IMAP_HASH_NB,
+};
+
+#define IMAP_PROBEHIST_NB 16
+
+/* probehist[i]: 探测长度在[2^i, 2^(i+1))之间的key个数 */
+typedef struct ImapStats {
+    size_t cap;
+    size_t count;
+    size_t bytes;
+    size_t maxprobe;
+    size_t probehist[IMAP_PROBEHIST_NB];
+} ImapStats;
+
+/* 和lua_Alloc同样的约定，由使用者决定内存从哪来、怎么记账 */
+typedef void *(*ImapAlloc)(void *ud, void *ptr, size_t osize, size_t nsize);
+
+/* 开放寻址的uint64 -> void *表，线性探测，key为0的槽表示空，key 0本身单独存 */
+typedef struct ImapSlot {
+    uint64_t key;
+    void *val;
+} ImapSlot;
 
 typedef struct ImapContext {
-    struct avl_hash_map table;
+    ImapSlot *slots;
+    size_t cap;
+    size_t mask;
+    size_t count;
+    int shift;
+    int hash;
+    bool haszero;
+    void *zeroval;
+    ImapAlloc af;
+    void *ud;
 } ImapContext;
 
-void imap_init(ImapContext *);
+void imap_init(ImapContext *, ImapAlloc af, void *ud);
 void imap_destroy(ImapContext *);
 
-void imap_set(ImapContext *, uint64_t key, void *val);
+bool imap_set(ImapContext *, uint64_t key, void *val);
 bool imap_get(ImapContext *, uint64_t key, void **out);
 void imap_remove(ImapContext *, uint64_t key);
 void imap_clear(ImapContext *);
+bool imap_reserve(ImapContext *, size_t count);
+void imap_trim(ImapContext *);
+size_t imap_count(ImapContext *);
+void imap_sethash(ImapContext *, int hash);
+void imap_stats(ImapContext *, ImapStats *out);
 
 typedef void (*ImapForeachCb)(void *ud, uint64_t key, void *val);
 void imap_foreach(ImapContext *, ImapForeachCb cb, void *ud);
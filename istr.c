@@ -0,0 +1,108 @@
+#include "istr.h"
+#include <string.h>
+
+/* FNV-1a，map里会再按imap的hash混一次 */
+static inline uint64_t istr_hash(const char *s, size_t len){
+    uint64_t h = 14695981039346656037ull;
+
+    for(size_t i = 0; i < len; ++i){
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+
+    return h;
+}
+
+void istr_init(IstrContext *ic, ImapAlloc af, void *ud){
+    imap_init(&ic->map, af, ud);
+    ic->count = 0;
+    ic->bytes = 0;
+}
+
+static void istr_freechain(void *ud, uint64_t key, void *val){
+    IstrContext *ic = ud;
+    IstrNode *node = val;
+
+    while(node){
+        IstrNode *next = node->next;
+        ic->map.af(ic->map.ud, node, sizeof(node[0]) + node->len + 1, 0);
+        node = next;
+    }
+}
+
+void istr_destroy(IstrContext *ic){
+    imap_foreach(&ic->map, istr_freechain, ic);
+    imap_destroy(&ic->map);
+    ic->count = 0;
+    ic->bytes = 0;
+}
+
+const char *istr_intern(IstrContext *ic, const char *s){
+    IstrNode *head = NULL;
+    IstrNode *node;
+    uint64_t hash;
+    size_t len;
+    void *val;
+
+    s = s ? s : "";
+    len = strlen(s);
+    hash = istr_hash(s, len);
+
+    if(imap_get(&ic->map, hash, &val)){
+        head = val;
+        for(node = head; node; node = node->next){
+            if(node->len == len && memcmp(node->str, s, len) == 0){
+                return node->str;
+            }
+        }
+    }
+
+    node = ic->map.af(ic->map.ud, NULL, 0, sizeof(node[0]) + len + 1);
+    if(!node){
+        return NULL;
+    }
+
+    node->next = head;
+    node->hash = hash;
+    node->len = len;
+    node->tag = 0;
+    node->id = (uint32_t)ic->count;
+    memcpy(node->str, s, len + 1);
+
+    if(!imap_set(&ic->map, hash, node)){
+        ic->map.af(ic->map.ud, node, sizeof(node[0]) + len + 1, 0);
+        return NULL;
+    }
+
+    ++ic->count;
+    ic->bytes += sizeof(node[0]) + len + 1;
+    return node->str;
+}
+
+size_t istr_count(IstrContext *ic){
+    return ic->count;
+}
+
+bool istr_reserve(IstrContext *ic, size_t count){
+    return imap_reserve(&ic->map, count);
+}
+
+typedef struct IstrForeachArg {
+    IstrForeachCb cb;
+    void *ud;
+} IstrForeachArg;
+
+static void istr_foreachchain(void *ud, uint64_t key, void *val){
+    IstrForeachArg *arg = ud;
+
+    for(IstrNode *node = val; node; node = node->next){
+        arg->cb(arg->ud, node);
+    }
+}
+
+/* 遍历期间不能再驻留新串 */
+void istr_foreach(IstrContext *ic, IstrForeachCb cb, void *ud){
+    IstrForeachArg arg = {cb, ud};
+
+    imap_foreach(&ic->map, istr_foreachchain, &arg);
+}
@@ -0,0 +1,42 @@
+#ifndef __ISTR_H__
+#define __ISTR_H__
+
+#include "imap.h"
+
+/* 字符串驻留表，同样内容只存一份，返回的指针在istr_destroy之前一直有效；
+ * id按驻留的先后从0编号，istr_destroy之前不变，可以代替指针当key；
+ * tag留给使用者做标记，新串为0，istr自己不读 */
+typedef struct IstrNode {
+    struct IstrNode *next;
+    uint64_t hash;
+    size_t len;
+    uint32_t tag;
+    uint32_t id;
+    char str[];
+} IstrNode;
+
+/* map: hash -> 同hash的链表头 */
+typedef struct IstrContext {
+    ImapContext map;
+    size_t count;
+    size_t bytes;
+} IstrContext;
+
+void istr_init(IstrContext *, ImapAlloc af, void *ud);
+void istr_destroy(IstrContext *);
+
+/* s为NULL当作空串，分配失败返回NULL */
+const char *istr_intern(IstrContext *, const char *s);
+size_t istr_count(IstrContext *);
+/* 预留到能放下count个不同hash的串而不再扩容，串本身仍在第一次驻留时分配；分配失败返回false */
+bool istr_reserve(IstrContext *, size_t count);
+
+/* 由istr_intern返回的指针找回所在的节点 */
+static inline IstrNode *istr_node(const char *s){
+    return (IstrNode *)(s - offsetof(IstrNode, str));
+}
+
+typedef void (*IstrForeachCb)(void *ud, IstrNode *node);
+void istr_foreach(IstrContext *, IstrForeachCb cb, void *ud);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef __LPBIN_H__
+#define __LPBIN_H__
+
+#include <stdint.h>
+
+/* pdumpbin的二进制格式，所有整数都是小端：
+ *   header | strings | rows
+ * header: magic[4] version header_size row_size strnb strbytes rownb flags，除magic外都是u32
+ * strings: strnb个{len:u32, bytes[len]}，不带结尾的0，按出现顺序从0编号，strbytes是这一段的总字节数
+ * rows: rownb个定长的行，字段偏移见下面，字符串字段存的是编号，时间都已换算成纳秒
+ * 读的时候按header里的header_size/row_size跳，以后加字段只往末尾加，version只在不兼容时才改 */
+#define LPBIN_MAGIC "LPRB"
+#define LPBIN_VERSION 1
+
+enum {
+    LPBIN_HDR_MAGIC = 0,
+    LPBIN_HDR_VERSION = 4,
+    LPBIN_HDR_HEADERSIZE = 8,
+    LPBIN_HDR_ROWSIZE = 12,
+    LPBIN_HDR_STRNB = 16,
+    LPBIN_HDR_STRBYTES = 20,
+    LPBIN_HDR_ROWNB = 24,
+    LPBIN_HDR_FLAGS = 28,
+    LPBIN_HEADER_SIZE = 32,
+};
+
+/* key和pdump的key一致；latency_*只在flags带LPBIN_ROW_LATENCY时有意义 */
+enum {
+    LPBIN_ROW_KEY = 0,              /* u64 */
+    LPBIN_ROW_SOURCE = 8,           /* u32 字符串编号 */
+    LPBIN_ROW_NAME = 12,            /* u32 */
+    LPBIN_ROW_NAMEWHAT = 16,        /* u32 */
+    LPBIN_ROW_WHAT = 20,            /* u32 */
+    LPBIN_ROW_LINE = 24,            /* i32 */
+    LPBIN_ROW_FLAGS = 28,           /* u32 */
+    LPBIN_ROW_CALLNB = 32,          /* u64，以下都是u64 */
+    LPBIN_ROW_TOTAL = 40,
+    LPBIN_ROW_REAL = 48,
+    LPBIN_ROW_COROUTINE = 56,
+    LPBIN_ROW_SAMPLENB = 64,
+    LPBIN_ROW_SELFSAMPLENB = 72,
+    LPBIN_ROW_LATENCYNB = 80,
+    LPBIN_ROW_LATENCYMIN = 88,
+    LPBIN_ROW_LATENCYMAX = 96,
+    LPBIN_ROW_P50 = 104,
+    LPBIN_ROW_P90 = 112,
+    LPBIN_ROW_P99 = 120,
+    LPBIN_ROW_P999 = 128,
+    LPBIN_ROW_SIZE = 136,
+};
+
+enum {
+    LPBIN_ROW_TAILCALL = 1,
+    LPBIN_ROW_LATENCY = 2,
+};
+
+static inline void lpbin_putu32(unsigned char *p, uint32_t v){
+    for(int i = 0; i < 4; ++i){
+        p[i] = (unsigned char)(v >> (i * 8));
+    }
+}
+
+static inline void lpbin_putu64(unsigned char *p, uint64_t v){
+    for(int i = 0; i < 8; ++i){
+        p[i] = (unsigned char)(v >> (i * 8));
+    }
+}
+
+static inline uint32_t lpbin_getu32(const unsigned char *p){
+    uint32_t v = 0;
+
+    for(int i = 3; i >= 0; --i){
+        v = (v << 8) | p[i];
+    }
+
+    return v;
+}
+
+static inline uint64_t lpbin_getu64(const unsigned char *p){
+    uint64_t v = 0;
+
+    for(int i = 7; i >= 0; --i){
+        v = (v << 8) | p[i];
+    }
+
+    return v;
+}
+
+#endif
@@ -0,0 +1,386 @@
+/* pdumpbin输出的解码工具，不依赖Lua：
+ *   cc -O2 -o lpdecode lpdecode.c
+ *   lpdecode [-f text|csv|json] [file]   不给file或给"-"时读标准输入 */
+#include "lpbin.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+enum {
+    FMT_TEXT,
+    FMT_CSV,
+    FMT_JSON,
+};
+
+typedef struct Str {
+    const char *s;
+    uint32_t len;
+} Str;
+
+typedef struct Snapshot {
+    unsigned char *data;
+    size_t size;
+    uint32_t version;
+    uint32_t rowsize;
+    uint32_t strnb;
+    uint32_t rownb;
+    Str *strs;
+    const unsigned char *rows;
+} Snapshot;
+
+static unsigned char *__read_all(FILE *fp, size_t *size){
+    size_t cap = 65536;
+    size_t nb = 0;
+    unsigned char *buf = malloc(cap);
+
+    while(buf){
+        size_t n = fread(buf + nb, 1, cap - nb, fp);
+        nb += n;
+        if(n == 0){
+            break;
+        }
+
+        if(nb == cap){
+            unsigned char *newbuf = realloc(buf, cap * 2);
+            if(!newbuf){
+                free(buf);
+                return NULL;
+            }
+            buf = newbuf;
+            cap *= 2;
+        }
+    }
+
+    if(buf && ferror(fp)){
+        free(buf);
+        return NULL;
+    }
+
+    *size = nb;
+    return buf;
+}
+
+/* 只校验长度和编号都不越界，字段含义交给输出 */
+static const char *__snapshot_parse(Snapshot *ss){
+    const unsigned char *p = ss->data;
+    uint32_t hdrsize;
+    uint32_t strbytes;
+    size_t off;
+
+    if(ss->size < LPBIN_HEADER_SIZE || memcmp(p + LPBIN_HDR_MAGIC, LPBIN_MAGIC, 4) != 0){
+        return "not a lprofile snapshot";
+    }
+
+    ss->version = lpbin_getu32(p + LPBIN_HDR_VERSION);
+    if(ss->version != LPBIN_VERSION){
+        return "unsupported version";
+    }
+
+    hdrsize = lpbin_getu32(p + LPBIN_HDR_HEADERSIZE);
+    ss->rowsize = lpbin_getu32(p + LPBIN_HDR_ROWSIZE);
+    ss->strnb = lpbin_getu32(p + LPBIN_HDR_STRNB);
+    strbytes = lpbin_getu32(p + LPBIN_HDR_STRBYTES);
+    ss->rownb = lpbin_getu32(p + LPBIN_HDR_ROWNB);
+
+    /* 老的解码器读新的文件：多出来的header和行尾字段跳过 */
+    if(hdrsize < LPBIN_HEADER_SIZE || ss->rowsize < LPBIN_ROW_SIZE){
+        return "header or row too small";
+    }
+
+    if((uint64_t)hdrsize + strbytes + (uint64_t)ss->rownb * ss->rowsize > ss->size){
+        return "truncated snapshot";
+    }
+
+    ss->strs = calloc(ss->strnb ? ss->strnb : 1, sizeof(ss->strs[0]));
+    if(!ss->strs){
+        return "out of memory";
+    }
+
+    off = hdrsize;
+    for(uint32_t i = 0; i < ss->strnb; ++i){
+        uint32_t len;
+
+        if(off + 4 > (size_t)hdrsize + strbytes){
+            return "bad string table";
+        }
+
+        len = lpbin_getu32(p + off);
+        off += 4;
+        if(off + len > (size_t)hdrsize + strbytes){
+            return "bad string table";
+        }
+
+        ss->strs[i].s = (const char *)p + off;
+        ss->strs[i].len = len;
+        off += len;
+    }
+
+    ss->rows = p + hdrsize + strbytes;
+
+    for(uint32_t i = 0; i < ss->rownb; ++i){
+        const unsigned char *row = ss->rows + (size_t)i * ss->rowsize;
+
+        if(lpbin_getu32(row + LPBIN_ROW_SOURCE) >= ss->strnb
+                || lpbin_getu32(row + LPBIN_ROW_NAME) >= ss->strnb
+                || lpbin_getu32(row + LPBIN_ROW_NAMEWHAT) >= ss->strnb
+                || lpbin_getu32(row + LPBIN_ROW_WHAT) >= ss->strnb){
+            return "string index out of range";
+        }
+    }
+
+    return NULL;
+}
+
+static inline Str __row_str(Snapshot *ss, const unsigned char *row, int field){
+    return ss->strs[lpbin_getu32(row + field)];
+}
+
+/* 按格式转义：csv把双引号写两遍，json转义引号、反斜杠和控制字符 */
+static void __print_str(Str str, int fmt){
+    if(fmt == FMT_TEXT){
+        fwrite(str.s, 1, str.len, stdout);
+        return;
+    }
+
+    putchar('"');
+    for(uint32_t i = 0; i < str.len; ++i){
+        unsigned char c = (unsigned char)str.s[i];
+
+        if(fmt == FMT_CSV){
+            if(c == '"'){
+                putchar('"');
+            }
+            putchar(c);
+        }else if(c == '"' || c == '\\'){
+            printf("\\%c", c);
+        }else if(c < 0x20){
+            printf("\\u%04x", c);
+        }else{
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static const char *const counter_names[] = {
+    "callnb",
+    "total_nspan",
+    "real_nspan",
+    "coroutine_nspan",
+    "samplenb",
+    "self_samplenb",
+};
+
+static const int counter_fields[] = {
+    LPBIN_ROW_CALLNB,
+    LPBIN_ROW_TOTAL,
+    LPBIN_ROW_REAL,
+    LPBIN_ROW_COROUTINE,
+    LPBIN_ROW_SAMPLENB,
+    LPBIN_ROW_SELFSAMPLENB,
+};
+
+static const char *const latency_names[] = {
+    "nb",
+    "min",
+    "max",
+    "p50",
+    "p90",
+    "p99",
+    "p999",
+};
+
+static const int latency_fields[] = {
+    LPBIN_ROW_LATENCYNB,
+    LPBIN_ROW_LATENCYMIN,
+    LPBIN_ROW_LATENCYMAX,
+    LPBIN_ROW_P50,
+    LPBIN_ROW_P90,
+    LPBIN_ROW_P99,
+    LPBIN_ROW_P999,
+};
+
+#define COUNTER_NB (int)(sizeof(counter_fields) / sizeof(counter_fields[0]))
+#define LATENCY_NB (int)(sizeof(latency_fields) / sizeof(latency_fields[0]))
+
+static void __print_text(Snapshot *ss){
+    printf("%-18s %12s %14s %14s %10s %12s %12s  %s\n",
+            "key", "callnb", "total_nspan", "real_nspan", "samplenb", "p50", "p99", "function");
+
+    for(uint32_t i = 0; i < ss->rownb; ++i){
+        const unsigned char *row = ss->rows + (size_t)i * ss->rowsize;
+        bool latency = lpbin_getu32(row + LPBIN_ROW_FLAGS) & LPBIN_ROW_LATENCY;
+        Str name = __row_str(ss, row, LPBIN_ROW_NAME);
+
+        printf("0x%016" PRIx64 " %12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %10" PRIu64,
+                lpbin_getu64(row + LPBIN_ROW_KEY),
+                lpbin_getu64(row + LPBIN_ROW_CALLNB),
+                lpbin_getu64(row + LPBIN_ROW_TOTAL),
+                lpbin_getu64(row + LPBIN_ROW_REAL),
+                lpbin_getu64(row + LPBIN_ROW_SAMPLENB));
+
+        if(latency){
+            printf(" %12" PRIu64 " %12" PRIu64, lpbin_getu64(row + LPBIN_ROW_P50), lpbin_getu64(row + LPBIN_ROW_P99));
+        }else{
+            printf(" %12s %12s", "-", "-");
+        }
+
+        printf("  ");
+        __print_str(name.len ? name : (Str){"?", 1}, FMT_TEXT);
+        printf(" (");
+        __print_str(__row_str(ss, row, LPBIN_ROW_SOURCE), FMT_TEXT);
+        printf(":%d)\n", (int32_t)lpbin_getu32(row + LPBIN_ROW_LINE));
+    }
+}
+
+static void __print_csv(Snapshot *ss){
+    printf("key,source,name,namewhat,what,line,istailcall");
+    for(int f = 0; f < COUNTER_NB; ++f){
+        printf(",%s", counter_names[f]);
+    }
+    for(int f = 0; f < LATENCY_NB; ++f){
+        printf(",latency_%s", latency_names[f]);
+    }
+    printf("\n");
+
+    for(uint32_t i = 0; i < ss->rownb; ++i){
+        const unsigned char *row = ss->rows + (size_t)i * ss->rowsize;
+        uint32_t flags = lpbin_getu32(row + LPBIN_ROW_FLAGS);
+
+        printf("%" PRIu64 ",", lpbin_getu64(row + LPBIN_ROW_KEY));
+        __print_str(__row_str(ss, row, LPBIN_ROW_SOURCE), FMT_CSV);
+        putchar(',');
+        __print_str(__row_str(ss, row, LPBIN_ROW_NAME), FMT_CSV);
+        putchar(',');
+        __print_str(__row_str(ss, row, LPBIN_ROW_NAMEWHAT), FMT_CSV);
+        putchar(',');
+        __print_str(__row_str(ss, row, LPBIN_ROW_WHAT), FMT_CSV);
+        printf(",%d,%d", (int32_t)lpbin_getu32(row + LPBIN_ROW_LINE), (flags & LPBIN_ROW_TAILCALL) ? 1 : 0);
+
+        for(int f = 0; f < COUNTER_NB; ++f){
+            printf(",%" PRIu64, lpbin_getu64(row + counter_fields[f]));
+        }
+
+        /* 没有直方图的留空，和0区分开 */
+        for(int f = 0; f < LATENCY_NB; ++f){
+            if(flags & LPBIN_ROW_LATENCY){
+                printf(",%" PRIu64, lpbin_getu64(row + latency_fields[f]));
+            }else{
+                putchar(',');
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void __print_json(Snapshot *ss){
+    printf("[");
+
+    for(uint32_t i = 0; i < ss->rownb; ++i){
+        const unsigned char *row = ss->rows + (size_t)i * ss->rowsize;
+        uint32_t flags = lpbin_getu32(row + LPBIN_ROW_FLAGS);
+
+        printf("%s\n{\"key\":%" PRIu64 ",\"source\":", i ? "," : "", lpbin_getu64(row + LPBIN_ROW_KEY));
+        __print_str(__row_str(ss, row, LPBIN_ROW_SOURCE), FMT_JSON);
+        printf(",\"name\":");
+        __print_str(__row_str(ss, row, LPBIN_ROW_NAME), FMT_JSON);
+        printf(",\"namewhat\":");
+        __print_str(__row_str(ss, row, LPBIN_ROW_NAMEWHAT), FMT_JSON);
+        printf(",\"what\":");
+        __print_str(__row_str(ss, row, LPBIN_ROW_WHAT), FMT_JSON);
+        printf(",\"line\":%d,\"istailcall\":%s", (int32_t)lpbin_getu32(row + LPBIN_ROW_LINE),
+                (flags & LPBIN_ROW_TAILCALL) ? "true" : "false");
+
+        for(int f = 0; f < COUNTER_NB; ++f){
+            printf(",\"%s\":%" PRIu64, counter_names[f], lpbin_getu64(row + counter_fields[f]));
+        }
+
+        if(flags & LPBIN_ROW_LATENCY){
+            printf(",\"latency\":{");
+            for(int f = 0; f < LATENCY_NB; ++f){
+                printf("%s\"%s\":%" PRIu64, f ? "," : "", latency_names[f], lpbin_getu64(row + latency_fields[f]));
+            }
+            printf("}");
+        }
+
+        printf("}");
+    }
+
+    printf("\n]\n");
+}
+
+static void __usage(const char *prog){
+    fprintf(stderr, "usage: %s [-f text|csv|json] [file]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv){
+    static const char *const fmt_names[] = {"text", "csv", "json"};
+    Snapshot ss;
+    const char *path = NULL;
+    const char *err;
+    FILE *fp = stdin;
+    int fmt = FMT_TEXT;
+    int i;
+
+    for(i = 1; i < argc; ++i){
+        if(strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+            const char *name = argv[++i];
+
+            for(fmt = 0; fmt < 3 && strcmp(name, fmt_names[fmt]) != 0; ++fmt){
+            }
+            if(fmt >= 3){
+                __usage(argv[0]);
+            }
+        }else if(!path){
+            path = argv[i];
+        }else{
+            __usage(argv[0]);
+        }
+    }
+
+    if(path && strcmp(path, "-") != 0){
+        fp = fopen(path, "rb");
+        if(!fp){
+            perror(path);
+            return 1;
+        }
+    }
+
+    memset(&ss, 0, sizeof(ss));
+    ss.data = __read_all(fp, &ss.size);
+    if(fp != stdin){
+        fclose(fp);
+    }
+
+    if(!ss.data){
+        fprintf(stderr, "%s: read failed\n", path ? path : "stdin");
+        return 1;
+    }
+
+    err = __snapshot_parse(&ss);
+    if(err){
+        fprintf(stderr, "%s: %s\n", path ? path : "stdin", err);
+        free(ss.strs);
+        free(ss.data);
+        return 1;
+    }
+
+    switch(fmt){
+        case FMT_CSV:
+            __print_csv(&ss);
+            break;
+        case FMT_JSON:
+            __print_json(&ss);
+            break;
+        default:
+            __print_text(&ss);
+            break;
+    }
+
+    free(ss.strs);
+    free(ss.data);
+    return 0;
+}
@@ -1,87 +1,484 @@
 #include "lprofile.h"
 #include "imap.h"
+#include "istr.h"
+#include "lpbin.h"
 #include <lauxlib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LP_HAVE_TSC 1
+#elif defined(__aarch64__)
+#define LP_HAVE_TSC 1
+#else
+#define LP_HAVE_TSC 0
+#endif
 
 #define LPROFILE_METATBL_NAME "_LPMETA_"
-#define LPROFILE_REGKEY_NAME "_LPREG_"
+#define LPROFILE_CURSOR_NAME "_LPCURSOR_"
+
+static const char LPROFILE_REGKEY = 0;
+/* pfilter的配置表{find=string.find, include={...}, exclude={...}} */
+static const char LPROFILE_FILTERKEY = 0;
+/* pbegin过还没pend的线程{[thread]=true}，定时器信号只碰这里挂着的lua_State */
+static const char LPROFILE_THREADSKEY = 0;
 
 #define LP_ENABLE_LOG 0
 
+#ifndef LP_ENABLE_TRACETAILCALL
+#define LP_ENABLE_TRACETAILCALL 1
+#endif
+
+#ifndef LP_ENABLE_YIELD
+#define LP_ENABLE_YIELD 1
+#endif
+
+#ifndef LP_ENABLE_CAPTURENAME
+#define LP_ENABLE_CAPTURENAME 1
+#endif
+
+#ifndef LP_ENABLE_TIMER
+#if defined(__linux__)
+#define LP_ENABLE_TIMER 1
+#else
+#define LP_ENABLE_TIMER 0
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LP_FORCEINLINE inline __attribute__((always_inline))
+#else
+#define LP_FORCEINLINE inline
+#endif
+
 #if LP_ENABLE_LOG
 #define lplog(fmt, args...) printf(fmt, ## args)
 #else
 #define lplog(fmt, args...)
 #endif
 
-typedef struct CallFrame {
-    void *proto;
-    const char *source;
-    const char *name;
-    const char *namewhat;
-    const char *what;
+/* 记录里的时间都是所选时间源的原始单位，只在输出时换算成纳秒 */
+enum {
+    LP_CLOCK_REALTIME,
+    LP_CLOCK_MONOTONIC,
+    LP_CLOCK_MONOTONIC_COARSE,
+    LP_CLOCK_THREAD_CPUTIME,
+    LP_CLOCK_TSC,
+    LP_CLOCK_NB,
+};
+
+enum {
+    LP_MODE_TRACE,
+    LP_MODE_SAMPLE,
+    LP_MODE_TIMER,
+    LP_MODE_LINE,
+    LP_MODE_NB,
+};
+
+static const char *const lp_mode_names[] = {
+    "trace",
+    "sample",
+    "timer",
+    "line",
+    NULL,
+};
+
+static const char *const lp_hash_names[] = {
+    "fibonacci",
+    "murmur",
+    "identity",
+    NULL,
+};
+
+enum {
+    LP_MEM_CONTEXT,
+    LP_MEM_RECORDS,
+    LP_MEM_STACKS,
+    LP_MEM_MAPS,
+    LP_MEM_STRINGS,
+    LP_MEM_EDGES,
+    LP_MEM_CCT,
+    LP_MEM_LINES,
+    LP_MEM_HISTS,
+    LP_MEM_NB,
+};
+
+static const char *const lp_mem_names[] = {
+    "context",
+    "records",
+    "stacks",
+    "maps",
+    "strings",
+    "edges",
+    "cct",
+    "lines",
+    "hists",
+    NULL,
+};
+
+/* proto和line都按source内容:linedefined合并，同一行上定义的几个函数算一条 */
+enum {
+    LP_AGG_CLOSURE,
+    LP_AGG_PROTO,
+    LP_AGG_LINE,
+};
+
+static const char *const lp_agg_names[] = {
+    "closure",
+    "proto",
+    "line",
+    NULL,
+};
+
+enum {
+    LP_TOP_TOTAL,
+    LP_TOP_SELF,
+    LP_TOP_COROUTINE,
+    LP_TOP_CALLS,
+    LP_TOP_MEAN,
+    LP_TOP_SAMPLES,
+    LP_TOP_SELFSAMPLES,
+    LP_TOP_P50,
+    LP_TOP_P90,
+    LP_TOP_P99,
+    LP_TOP_P999,
+    LP_TOP_MAX,
+};
+
+static const char *const lp_top_names[] = {
+    "total",
+    "self",
+    "coroutine",
+    "calls",
+    "mean",
+    "samples",
+    "selfsamples",
+    "p50",
+    "p90",
+    "p99",
+    "p999",
+    "max",
+    NULL,
+};
+
+/* 栈容量总是LP_STACK_MINCAP << k，按k分桶回收 */
+#define LP_STACK_MINCAP 16
+#define LP_STACK_CLASSNB 20
+#define LP_RECORD_MINCAP 64
+#define LP_EDGE_MINCAP 64
+
+#define LP_LINE_MINCAP 16
+
+/* 小于2^SUBBITS的值每个一个桶，之后每个2的幂再等分2^SUBBITS份 */
+#define LP_HIST_SUBBITS 4
+#define LP_HIST_SUBNB (1 << LP_HIST_SUBBITS)
+#define LP_HIST_MAXBITS 44
+#define LP_HIST_BUCKETNB ((LP_HIST_MAXBITS - LP_HIST_SUBBITS + 1) << LP_HIST_SUBBITS)
+
+/* 0号是根，1号是[truncated] */
+#define LP_CCT_ROOT 0
+#define LP_CCT_TRUNCATED 1
+#define LP_CCT_INLINE 4
+#define LP_CCT_MINCAP 64
+#define LP_CCT_MAXNODES 65536
+#define LP_CCT_MAXDEPTH 512
+
+#define LP_SAMPLE_EVERY 1000
+#define LP_SAMPLE_MAXDEPTH 256
+
+enum {
+    LP_TIMER_CPU,
+    LP_TIMER_WALL,
+};
+
+static const char *const lp_timer_names[] = {
+    "cpu",
+    "wall",
+    NULL,
+};
+
+#define LP_TIMER_HZ 1000
+#define LP_TIMER_MAXTHREAD 64
+#define LP_TIMER_MAXCTX 16
+
+enum {
+    LP_EVT_CALL,
+    LP_EVT_RET,
+    LP_EVT_TAILCALL,
+    LP_EVT_NB,
+};
+
+static const char *const lp_evt_names[] = {
+    "call",
+    "ret",
+    "tailcall",
+    NULL,
+};
+
+#define LP_OVERHEAD_BUCKETNB 64
+#define LP_CALIB_LOOP 1000
+#define LP_CALIB_ROUND 7
+
+static const char *const lp_clock_names[] = {
+    "realtime",
+    "monotonic",
+    "monotonic_coarse",
+    "thread_cputime",
+    "tsc",
+    NULL,
+};
+
+typedef struct ClockContext {
+    int source;
+    bool calibrated;
+    uint64_t base_ticks;
+    uint64_t base_ns;
+    double nspertick;
+} ClockContext;
+
+/* threads/threadnb会在信号处理函数里读，修改时要屏蔽SIGPROF */
+typedef struct TimerContext {
+    int clock;
+    int hz;
+    bool active;
+#if LP_ENABLE_TIMER
+    timer_t id;
+#endif
+    volatile sig_atomic_t threadnb;
+    lua_State *threads[LP_TIMER_MAXTHREAD];
+} TimerContext;
+
+/* 事件时间点之前的hook开销量不到，由pbegin时的校准估成每个事件一个常数 */
+typedef struct OverheadContext {
+    bool calibrated;
+    uint64_t unmeasured[LP_EVT_NB];
+    uint64_t calib_measured;
+    uint64_t hist[LP_EVT_NB][LP_OVERHEAD_BUCKETNB];
+} OverheadContext;
+
+typedef struct FilterContext {
+    bool enabled;
+    bool exclude_c;
+    int includenb;
+    int excludenb;
+} FilterContext;
+
+typedef struct LineContext {
+    bool sample;
+    int id;
     int line;
-    int istailcall;
-    uint64_t call_evt_hpc;
-    uint64_t call_real_hpc;
-    uint64_t ret_hpc;
-    uint64_t total_nspan;
-    uint64_t real_nspan;
+    uint64_t start_hpc;
+    void *lastkey;
+    int lastid;
+} LineContext;
+
+struct MemContext;
+
+typedef struct MemAccount {
+    struct MemContext *mc;
+    size_t used;
+} MemAccount;
+
+typedef struct MemContext {
+    lua_Alloc af;
+    void *ud;
+    size_t total;
+    size_t budget;
+    MemAccount accounts[LP_MEM_NB];
+} MemContext;
+
+typedef struct CallFrame {
+    int id;
+    int node;
+    uint8_t istailcall;
+    uint8_t filtered;
+    uint64_t start_hpc;
     uint64_t sub_nspan;
     uint64_t yield_nspan;
+    uint64_t loss_nspan;
 } CallFrame;
 
-typedef struct ProtoRecord {
-    void *proto;
-    char source[64];
-    char name[32];
-    char namewhat[8];
-    char what[8];
-    int line;
-    int istailcall;
+typedef struct LatencyHist {
+    uint64_t nb;
+    uint64_t min;
+    uint64_t max;
+    uint32_t counts[LP_HIST_BUCKETNB];
+} LatencyHist;
+
+typedef struct RecordHot {
     int callnb;
+    uint8_t istailcall;
+    uint8_t dirty;
+    uint64_t total_nspan;
+    uint64_t real_nspan;
+    uint64_t coroutine_nspan;
+    LatencyHist *hist;
+} RecordHot;
+
+typedef struct LineStat {
+    uint64_t nspan;
+    uint32_t hitnb;
+    uint32_t samplenb;
+} LineStat;
+
+typedef struct RecordBase {
+    uint64_t callnb;
     uint64_t total_nspan;
     uint64_t real_nspan;
     uint64_t coroutine_nspan;
+    uint64_t samplenb;
+    uint64_t self_samplenb;
+} RecordBase;
+
+typedef struct ProtoRecord {
+    void *proto;
+    const char *source;
+    const char *name;
+    const char *namewhat;
+    const char *what;
+    int line;
+    int lastline;
+    int filtered;
+    int linenb;
+    LineStat *lines;
+    uint64_t samplenb;
+    uint64_t self_samplenb;
+    uint64_t sampleseq;
+    RecordBase base;
 } ProtoRecord;
 
+/* dirty和pool一样大：每条记录最多在脏列表里出现一次 */
 typedef struct RecordPool {
     ImapContext usedmap;
+    ImapContext keymap;
+    ImapContext srcmap;
+    IstrContext strs;
+    int aggregate;
     int cap;
     int nb;
+    int dirtynb;
+    uint64_t generation;    /* 每次reset加1，id重新从0分配，老的游标就作废了 */
     ProtoRecord *pool;
+    RecordHot *hot;
+    int *dirty;
+    MemAccount *mem;
+    MemAccount *linemem;
+    MemAccount *histmem;
+    int histafter;
+    uint64_t stat_dropnb;
+    uint64_t stat_linedropnb;
+    uint64_t stat_histdropnb;
 } RecordPool;
 
+typedef struct EdgeRecord {
+    int caller;
+    int callee;
+    uint64_t callnb;
+    uint64_t total_nspan;
+    uint64_t real_nspan;
+} EdgeRecord;
+
+/* map: caller<<32|callee -> pool下标 */
+typedef struct EdgePool {
+    ImapContext map;
+    int cap;
+    int nb;
+    EdgeRecord *pool;
+    MemAccount *mem;
+    uint64_t stat_dropnb;
+} EdgePool;
+
+typedef struct CctChild {
+    int record;
+    int node;
+} CctChild;
+
+typedef struct CctNode {
+    int record;
+    int parent;
+    int first_child;
+    int next_sibling;
+    int depth;
+    int inlinenb;
+    CctChild inlines[LP_CCT_INLINE];
+    uint64_t callnb;
+    uint64_t total_nspan;
+    uint64_t real_nspan;
+} CctNode;
+
+/* map: parent<<32|record -> 节点下标 */
+typedef struct CctContext {
+    bool enabled;
+    int maxnodes;
+    int maxdepth;
+    int cap;
+    int nb;
+    CctNode *nodes;
+    ImapContext map;
+    MemAccount *mem;
+    uint64_t stat_truncnb;
+} CctContext;
+
 typedef struct CallStack {
     int cap;
     int nb;
+    int maxnb;
     int ref;
+    bool running;
     CallFrame *stk;
+    MemAccount *mem;
     struct CallStack *nextnode;
 } CallStack;
 
 typedef struct CallStackPool {
     ImapContext usedmap;
-    CallStack freelist;
+    CallStack *freelist[LP_STACK_CLASSNB];
     int usednb;
     int freenb;
+    int runningnb;
     int stat_usednb;
+    int sizehint;
+    MemAccount *mem;
+    void *lastkey;
+    CallStack *lastcs;
 } CallStackPool;
 
 typedef struct ProfileContext {
-    ImapContext runnings;
+    MemContext mem;
     CallStackPool stacks;
     RecordPool records;
+    EdgePool edges;
+    CctContext cct;
     uint64_t stat_lossnspan;
     uint64_t stat_realnspan;
     uint64_t stat_yieldnspan;
+    uint64_t stat_eventnb;
+    uint64_t stat_samplenb;
+    ClockContext clock;
+    TimerContext timer;
+    OverheadContext overhead;
+    FilterContext filter;
+    LineContext line;
+    int maphash;
+    bool compensate;
+    int mode;
+    int sample_every;
     bool enabled;
     void *proto_yield;
+    void *proto_yieldkey;
     bool trace_tailcall;
+    bool capture_name;
+    bool graph;
 } ProfileContext;
 
 typedef struct DumpArg {
@@ -89,707 +486,3160 @@ typedef struct DumpArg {
     ProfileContext *pc;
 } DumpArg;
 
-static inline void __recordpool_init(lua_State *L, RecordPool *rp){
-    void *ud;
-    lua_Alloc af = lua_getallocf(L, &ud);
+static inline uint64_t __clock_gettime(clockid_t id){
+    struct timespec ti;
+    clock_gettime(id, &ti);
+    return (uint64_t)1000000000 * ti.tv_sec + (uint64_t)ti.tv_nsec;
+}
 
-    imap_init(&rp->usedmap);
-    rp->nb = 0;
-    rp->cap = 100;
-    rp->pool = af(ud, NULL, 0, rp->cap * sizeof(rp->pool[0]));
+static inline uint64_t __clock_readtsc(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return __clock_gettime(CLOCK_MONOTONIC);
+#endif
+}
 
-    lplog("__recordpool_init rp=%p\n", rp);
+static inline uint64_t gethpc(int source){
+    switch(source){
+        case LP_CLOCK_REALTIME:
+            return __clock_gettime(CLOCK_REALTIME);
+#ifdef CLOCK_MONOTONIC_COARSE
+        case LP_CLOCK_MONOTONIC_COARSE:
+            return __clock_gettime(CLOCK_MONOTONIC_COARSE);
+#endif
+        case LP_CLOCK_THREAD_CPUTIME:
+            return __clock_gettime(CLOCK_THREAD_CPUTIME_ID);
+        case LP_CLOCK_TSC:
+            return __clock_readtsc();
+        default:
+            return __clock_gettime(CLOCK_MONOTONIC);
+    }
 }
 
-static inline void __recordpool_destroy(lua_State *L, RecordPool *rp){
-    void *ud;
-    lua_Alloc af = lua_getallocf(L, &ud);
+static inline void __clock_init(ClockContext *cc){
+    cc->source = LP_CLOCK_MONOTONIC;
+    cc->calibrated = false;
+    cc->base_ticks = 0;
+    cc->base_ns = 0;
+    cc->nspertick = 1.0;
+}
 
-    af(ud, rp->pool, rp->cap * sizeof(rp->pool[0]), 0);
-    imap_destroy(&rp->usedmap);
+static inline void __clock_calibrate(ClockContext *cc){
+    uint64_t ticks;
+    uint64_t ns;
 
-    lplog("__recordpool_destroy rp=%p\n", rp);
-}
+    if(cc->source != LP_CLOCK_TSC){
+        return;
+    }
 
-static inline void __recordpool_clear(lua_State *L, RecordPool *rp){
-    imap_clear(&rp->usedmap);
-    rp->nb = 0;
-}
+    if(!cc->calibrated){
+        cc->base_ticks = __clock_readtsc();
+        cc->base_ns = __clock_gettime(CLOCK_MONOTONIC);
+        cc->calibrated = true;
+    }
 
-static void __recordpool_record(lua_State *L, RecordPool *rp, CallFrame *cf){
-    void *val;
-    ProtoRecord *pr;
+    do{
+        ticks = __clock_readtsc();
+        ns = __clock_gettime(CLOCK_MONOTONIC);
+    }while(ns - cc->base_ns < 1000000 || ticks == cc->base_ticks);
 
-    if(imap_get(&rp->usedmap, (uint64_t)cf->proto, &val)){
-        pr = &rp->pool[(uint64_t)val];
-    }else{
-        uint64_t id;
+    cc->nspertick = (double)(ns - cc->base_ns) / (double)(ticks - cc->base_ticks);
 
-        if(rp->nb >= rp->cap){
-            void *ud;
-            lua_Alloc af = lua_getallocf(L, &ud);
-            int newcap = rp->cap * 2;
+    lplog("__clock_calibrate nspertick=%f\n", cc->nspertick);
+}
 
-            rp->pool = af(ud, rp->pool, rp->cap * sizeof(rp->pool[0]), newcap * sizeof(rp->pool[0]));
-            rp->cap = newcap;
-        }
+static inline uint64_t __clock_tons(ClockContext *cc, uint64_t v){
+    return cc->source == LP_CLOCK_TSC ? (uint64_t)(v * cc->nspertick) : v;
+}
 
-        pr = &rp->pool[rp->nb];
-        id = rp->nb;
-        ++rp->nb;
+static inline int __lp_log2(uint64_t v){
+#if defined(__GNUC__) || defined(__clang__)
+    return v ? 63 - __builtin_clzll(v) : 0;
+#else
+    int n = 0;
+    while(v >>= 1){
+        ++n;
+    }
+    return n;
+#endif
+}
 
-        pr->proto = cf->proto;
+static inline void __overhead_init(OverheadContext *oc){
+    memset(oc, 0, sizeof(oc[0]));
+}
 
-#define SAFE_COPY_STRING(dst, src)\
-        do{\
-            (src) = (src) ? (src) : "";\
-            strncpy((dst), (src), sizeof(dst));\
-            (dst)[sizeof(dst) - 1] = 0;\
-        }while(0)
+static inline void __overhead_clearhist(OverheadContext *oc){
+    memset(oc->hist, 0, sizeof(oc->hist));
+}
 
-        SAFE_COPY_STRING(pr->source, cf->source);
-        SAFE_COPY_STRING(pr->name, cf->name);
-        SAFE_COPY_STRING(pr->namewhat, cf->namewhat);
-        SAFE_COPY_STRING(pr->what, cf->what);
+static inline void __overhead_record(OverheadContext *oc, int evt, uint64_t cost){
+    ++oc->hist[evt][__lp_log2(cost)];
+}
 
-#undef SAFE_COPY_STRING
+static inline uint64_t __overhead_median(OverheadContext *oc, int evt){
+    uint64_t total = 0;
+    uint64_t acc = 0;
 
-        pr->line = cf->line;
-        pr->istailcall = 0;
-        pr->callnb = 0;
-        pr->total_nspan = 0;
-        pr->real_nspan = 0;
-        pr->coroutine_nspan = 0;
+    for(int i = 0; i < LP_OVERHEAD_BUCKETNB; ++i){
+        total += oc->hist[evt][i];
+    }
 
-        imap_set(&rp->usedmap, (uint64_t)cf->proto, (void *)id);
+    for(int i = 0; i < LP_OVERHEAD_BUCKETNB; ++i){
+        acc += oc->hist[evt][i];
+        if(acc * 2 >= total && acc > 0){
+            return ((uint64_t)1 << i) + ((uint64_t)1 << i) / 2;
+        }
     }
 
-    ++pr->callnb;
-    pr->total_nspan += cf->total_nspan;
-    pr->real_nspan += cf->real_nspan;
-    pr->istailcall |= cf->istailcall;
-    pr->coroutine_nspan += cf->total_nspan - cf->yield_nspan;
+    return 0;
 }
 
-static inline void __callstack_init(lua_State *L, CallStack *cs){
-    void *ud;
-    lua_Alloc af = lua_getallocf(L, &ud);
-
-    cs->nb = 0;
-    cs->cap = 100;
-    cs->ref = 0;
-    cs->nextnode = NULL;
-    cs->stk = af(ud, NULL, 0, cs->cap * sizeof(cs->stk[0]));
+static inline uint64_t __overhead_sortmedian(uint64_t *v, int nb){
+    for(int i = 1; i < nb; ++i){
+        uint64_t x = v[i];
+        int j = i - 1;
+        while(j >= 0 && v[j] > x){
+            v[j + 1] = v[j];
+            --j;
+        }
+        v[j + 1] = x;
+    }
 
-    lplog("__callstack_init cs=%p\n", cs);
+    return v[nb / 2];
 }
 
-static inline void __callstack_destroy(lua_State *L, CallStack *cs){
-    void *ud;
-    lua_Alloc af = lua_getallocf(L, &ud);
+static void lua_hook_timer(lua_State *L, lua_Debug *ar);
 
-    af(ud, cs->stk, cs->cap * sizeof(cs->stk[0]), 0);
-    lplog("__callstack_destroy cs=%p\n", cs);
+static inline void __timer_init(TimerContext *tc){
+    tc->clock = LP_TIMER_CPU;
+    tc->hz = LP_TIMER_HZ;
+    tc->active = false;
+    tc->threadnb = 0;
 }
 
-static inline CallFrame *__callstack_push(lua_State *L, CallStack *cs){
-    CallFrame *cf;
+#if LP_ENABLE_TIMER
 
-    if(cs->nb >= cs->cap){
-        void *ud;
-        lua_Alloc af = lua_getallocf(L, &ud);
-        int newcap = cs->cap * 2;
+/* 开着的定时器；timer_delete之前排队的信号可能晚到，那时sival_ptr已经释放，只认这里登记着的 */
+static TimerContext *volatile lp_timers[LP_TIMER_MAXCTX];
+
+/* 信号处理函数里只做异步信号安全的事：给登记过的线程挂上一次性的count hook */
+static void __timer_sighandler(int sig, siginfo_t *si, void *uc){
+    TimerContext *tc;
+    bool live = false;
+    int nb;
 
-        cs->stk = af(ud, cs->stk, cs->cap * sizeof(cs->stk[0]), newcap * sizeof(cs->stk[0]));
-        cs->cap = newcap;
+    if(si->si_code != SI_TIMER || !(tc = si->si_value.sival_ptr)){
+        return;
+    }
+
+    for(int i = 0; i < LP_TIMER_MAXCTX && !live; ++i){
+        live = lp_timers[i] == tc;
     }
 
-    cf = &(cs->stk[cs->nb]);
-    ++cs->nb;
+    if(!live){
+        return;
+    }
 
-    return cf;
+    nb = tc->threadnb;
+    for(int i = 0; i < nb; ++i){
+        lua_sethook(tc->threads[i], lua_hook_timer, LUA_MASKCOUNT, 1);
+    }
 }
 
-static inline CallFrame *__callstack_pop(lua_State *L, CallStack *cs){
-    return cs->nb > 0 ? (--cs->nb, &cs->stk[cs->nb]) : NULL;
+static inline bool __timer_installhandler(){
+    static volatile int installed = 0;
+    struct sigaction sa;
+
+    if(installed){
+        return true;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = __timer_sighandler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if(sigaction(SIGPROF, &sa, NULL) != 0){
+        return false;
+    }
+
+    installed = 1;
+    return true;
 }
 
-static inline CallFrame *__callstack_top(lua_State *L, CallStack *cs){
-    return cs->nb > 0 ? &cs->stk[cs->nb - 1] : NULL;
+static inline void __timer_blocksignal(sigset_t *old){
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &set, old);
 }
 
-static inline void __callstackpool_newfreenode(lua_State *L, CallStackPool *csp){
-    void *ud;
-    lua_Alloc af = lua_getallocf(L, &ud);
-    CallStack *cs;
-    CallStack *nextnode;
+static inline void __timer_restoresignal(sigset_t *old){
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
 
-    cs = af(ud, NULL, 0, sizeof(cs[0]));
-    __callstack_init(L, cs);
+static inline bool __timer_start(TimerContext *tc){
+    struct sigevent sev;
+    struct itimerspec its;
+    long interval = 1000000000L / tc->hz;
+    int slot;
 
-    nextnode = csp->freelist.nextnode;
-    csp->freelist.nextnode = cs;
-    cs->nextnode = nextnode;
-    ++csp->freenb;
+    if(tc->active){
+        return true;
+    }
 
-    lplog("__callstackpool_newfreenode csp=%p,cs=%p,freenb=%d\n", csp, cs, csp->freenb);
-}
+    if(!__timer_installhandler()){
+        return false;
+    }
 
-static inline CallStack *__callstackpool_acquire(lua_State *L, CallStackPool *csp, void *key){
-    void *val;
-    CallStack *cs;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_value.sival_ptr = tc;
+#ifdef SIGEV_THREAD_ID
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev._sigev_un._tid = (pid_t)syscall(SYS_gettid);
+#else
+    sev.sigev_notify = SIGEV_SIGNAL;
+#endif
 
-    if(imap_get(&csp->usedmap, (uint64_t)key, &val)){
-        cs = val;
-    }else{
-        if(!csp->freelist.nextnode){
-            __callstackpool_newfreenode(L, csp);
+    for(slot = 0; slot < LP_TIMER_MAXCTX; ++slot){
+        if(__sync_bool_compare_and_swap(&lp_timers[slot], NULL, tc)){
+            break;
         }
+    }
 
-        cs = csp->freelist.nextnode;
-        csp->freelist.nextnode = cs->nextnode;
-        --csp->freenb;
-        ++csp->usednb;
-        csp->stat_usednb = csp->usednb > csp->stat_usednb ? csp->usednb : csp->stat_usednb;
+    if(slot >= LP_TIMER_MAXCTX){
+        return false;
+    }
 
-        imap_set(&csp->usedmap, (uint64_t)key, (void *)cs);
+    if(timer_create(tc->clock == LP_TIMER_CPU ? CLOCK_THREAD_CPUTIME_ID : CLOCK_MONOTONIC, &sev, &tc->id) != 0){
+        lp_timers[slot] = NULL;
+        return false;
+    }
 
-        lplog("__callstackpool_acquire csp=%p,key=%p\n", csp, key);
+    its.it_interval.tv_sec = interval / 1000000000L;
+    its.it_interval.tv_nsec = interval % 1000000000L;
+    its.it_value = its.it_interval;
+
+    if(timer_settime(tc->id, 0, &its, NULL) != 0){
+        timer_delete(tc->id);
+        lp_timers[slot] = NULL;
+        return false;
     }
 
-    ++cs->ref;
-    return cs;
+    tc->active = true;
+
+    lplog("__timer_start tc=%p,hz=%d\n", tc, tc->hz);
+    return true;
 }
 
-static inline CallStack *__callstackpool_get(lua_State *L, CallStackPool *csp, void *key){
-    void *val;
+static inline void __timer_stop(TimerContext *tc){
+    sigset_t old;
 
-    return imap_get(&csp->usedmap, (uint64_t)key, &val) ? (CallStack *)val : NULL;
-}
+    if(!tc->active){
+        return;
+    }
 
-static inline void __callstackpool_release(lua_State *L, CallStackPool *csp, void *key){
-    void *val;
-    CallStack *cs;
+    __timer_blocksignal(&old);
+    for(int i = 0; i < LP_TIMER_MAXCTX; ++i){
+        if(lp_timers[i] == tc){
+            lp_timers[i] = NULL;
+        }
+    }
+    timer_delete(tc->id);
+    tc->threadnb = 0;
+    tc->active = false;
+    __timer_restoresignal(&old);
 
-    if(imap_get(&csp->usedmap, (uint64_t)key, &val)){
-        cs = val;
-        --cs->ref;
+    lplog("__timer_stop tc=%p\n", tc);
+}
 
-        if(cs->ref <= 0){
-            CallStack *nextnode;
+static inline bool __timer_addthread(TimerContext *tc, lua_State *L){
+    sigset_t old;
+    bool ok = true;
+    int nb;
 
-            imap_remove(&csp->usedmap, (uint64_t)key);
-            nextnode = csp->freelist.nextnode;
-            csp->freelist.nextnode = cs;
-            cs->nextnode = nextnode;
-            ++csp->freenb;
-            --csp->usednb;
-            cs->ref = 0;
+    __timer_blocksignal(&old);
 
-            lplog("__callstackpool_release csp=%p,key=%p\n", csp, key);
+    nb = tc->threadnb;
+    for(int i = 0; i < nb; ++i){
+        if(tc->threads[i] == L){
+            __timer_restoresignal(&old);
+            return true;
         }
     }
+
+    if(nb < LP_TIMER_MAXTHREAD){
+        tc->threads[nb] = L;
+        tc->threadnb = nb + 1;
+    }else{
+        ok = false;
+    }
+
+    __timer_restoresignal(&old);
+    return ok;
 }
 
-static inline void __callstackpool_init(lua_State *L, CallStackPool *csp){
-    imap_init(&csp->usedmap);
-    csp->usednb = 0;
-    csp->freenb = 0;
-    csp->stat_usednb = 0;
-    csp->freelist.nextnode = NULL;
+static inline void __timer_removethread(TimerContext *tc, lua_State *L){
+    sigset_t old;
+    int nb;
 
-    for(int i = 0; i < 100; ++i){
-        __callstackpool_newfreenode(L, csp);
+    __timer_blocksignal(&old);
+
+    nb = tc->threadnb;
+    for(int i = 0; i < nb; ++i){
+        if(tc->threads[i] == L){
+            tc->threads[i] = tc->threads[nb - 1];
+            tc->threadnb = nb - 1;
+            break;
+        }
     }
 
-    lplog("__callstackpool_init csp=%p\n", csp);
+    __timer_restoresignal(&old);
 }
 
-static inline void __callstackpool_freeusednodecb(void *ud, uint64_t key, void *val){
-    lua_State *L = ud;
-    __callstack_destroy(L, (CallStack *)val);
+static inline void __timer_disarm(TimerContext *tc){
+    int nb = tc->threadnb;
 
-    lplog("__callstackpool_freeusednodecb key=%lu,val=%p\n", key, val);
+    for(int i = 0; i < nb; ++i){
+        lua_sethook(tc->threads[i], NULL, 0, 0);
+    }
 }
 
-static inline void __callstackpool_destroy(lua_State *L, CallStackPool *csp){
-    CallStack *cs;
+#else
 
-    while((cs = csp->freelist.nextnode) != NULL){
-        csp->freelist.nextnode = cs->nextnode;
-        __callstack_destroy(L, cs);
-    }
+static inline bool __timer_start(TimerContext *tc){
+    return false;
+}
 
-    imap_foreach(&csp->usedmap, __callstackpool_freeusednodecb, L);
-    imap_destroy(&csp->usedmap);
+static inline void __timer_stop(TimerContext *tc){
+}
 
-    lplog("__callstackpool_destroy csp=%p\n", csp);
+static inline bool __timer_addthread(TimerContext *tc, lua_State *L){
+    return false;
 }
 
-static inline void __profilecontext_init(lua_State *L, ProfileContext *pc){
-    imap_init(&pc->runnings);
-    __callstackpool_init(L, &pc->stacks);
-    __recordpool_init(L, &pc->records);
-    pc->stat_lossnspan = 0;
-    pc->stat_realnspan = 0;
-    pc->stat_yieldnspan = 0;
-    pc->enabled = true;
-    pc->proto_yield = NULL;
-    pc->trace_tailcall = false;
+static inline void __timer_removethread(TimerContext *tc, lua_State *L){
+}
 
-    lplog("__profilecontext_init pc=%p\n", pc);
+static inline void __timer_disarm(TimerContext *tc){
 }
 
-static inline void __profilecontext_destroy(lua_State *L, ProfileContext *pc){
-    __recordpool_destroy(L, &pc->records);
-    __callstackpool_destroy(L, &pc->stacks);
-    imap_destroy(&pc->runnings);
+#endif
 
-    lplog("__profilecontext_destroy pc=%p\n", pc);
+static inline void __mem_init(lua_State *L, MemContext *mc){
+    mc->af = lua_getallocf(L, &mc->ud);
+    mc->total = 0;
+    mc->budget = 0;
+
+    for(int i = 0; i < LP_MEM_NB; ++i){
+        mc->accounts[i].mc = mc;
+        mc->accounts[i].used = 0;
+    }
 }
 
-static ProfileContext *__profilecontext_getorcreate(lua_State *L);
+static void *__mem_alloc(void *ud, void *ptr, size_t osize, size_t nsize){
+    MemAccount *ma = ud;
+    MemContext *mc = ma->mc;
+    size_t old = ptr ? osize : 0;
+    void *p = mc->af(mc->ud, ptr, osize, nsize);
 
-static int __profilecontext_gc(lua_State *L){
-    void *ud;
-    lua_Alloc af = lua_getallocf(L, &ud);
-    ProfileContext *pc = *(ProfileContext **)lua_touserdata(L, -1);
-    __profilecontext_destroy(L, pc);
-    af(ud, pc, sizeof(pc[0]), 0);
+    if(nsize == 0 || p){
+        ma->used = ma->used - old + nsize;
+        mc->total = mc->total - old + nsize;
+    }
 
-    lplog("__profilecontext_gc pc=%p\n", pc);
-    return 0;
+    return p;
 }
 
-static inline ProfileContext *__profilecontext_get(lua_State *L){
-    ProfileContext *pc;
+static inline bool __mem_overbudget(MemContext *mc){
+    return mc->budget > 0 && mc->total >= mc->budget;
+}
 
-    lua_getfield(L, LUA_REGISTRYINDEX, LPROFILE_REGKEY_NAME);
+static inline void __recordpool_init(lua_State *L, RecordPool *rp, MemAccount *mem, MemAccount *mapmem,
+        MemAccount *strmem, MemAccount *linemem, MemAccount *histmem){
+    imap_init(&rp->usedmap, __mem_alloc, mapmem);
+    imap_init(&rp->keymap, __mem_alloc, mapmem);
+    imap_init(&rp->srcmap, __mem_alloc, mapmem);
+    istr_init(&rp->strs, __mem_alloc, strmem);
+    rp->aggregate = LP_AGG_CLOSURE;
+    rp->mem = mem;
+    rp->linemem = linemem;
+    rp->histmem = histmem;
+    rp->histafter = INT_MAX;
+    rp->stat_dropnb = 0;
+    rp->stat_linedropnb = 0;
+    rp->stat_histdropnb = 0;
+    rp->nb = 0;
+    rp->cap = 0;
+    rp->dirtynb = 0;
+    rp->generation = 0;
+    rp->pool = NULL;
+    rp->hot = NULL;
+    rp->dirty = NULL;
 
-    if(lua_isnil(L, -1)){
-        lua_pop(L, 1);
-        return NULL;
+    lplog("__recordpool_init rp=%p\n", rp);
+}
+
+static bool __recordpool_resize(RecordPool *rp, int newcap){
+    ProtoRecord *pool = NULL;
+    RecordHot *hot = NULL;
+    int *dirty = NULL;
+
+    if(newcap > 0){
+        pool = __mem_alloc(rp->mem, NULL, 0, newcap * sizeof(rp->pool[0]));
+        hot = pool ? __mem_alloc(rp->mem, NULL, 0, newcap * sizeof(rp->hot[0])) : NULL;
+        dirty = hot ? __mem_alloc(rp->mem, NULL, 0, newcap * sizeof(rp->dirty[0])) : NULL;
+        if(!dirty){
+            if(hot){
+                __mem_alloc(rp->mem, hot, newcap * sizeof(rp->hot[0]), 0);
+            }
+            if(pool){
+                __mem_alloc(rp->mem, pool, newcap * sizeof(rp->pool[0]), 0);
+            }
+            return false;
+        }
+
+        if(rp->nb > 0){
+            memcpy(pool, rp->pool, rp->nb * sizeof(rp->pool[0]));
+            memcpy(hot, rp->hot, rp->nb * sizeof(rp->hot[0]));
+        }
+
+        if(rp->dirtynb > 0){
+            memcpy(dirty, rp->dirty, rp->dirtynb * sizeof(rp->dirty[0]));
+        }
     }
 
-    pc = *(ProfileContext **)lua_touserdata(L, -1);
-    lua_pop(L, 1);
-    return pc;
+    if(rp->cap > 0){
+        __mem_alloc(rp->mem, rp->pool, rp->cap * sizeof(rp->pool[0]), 0);
+        __mem_alloc(rp->mem, rp->hot, rp->cap * sizeof(rp->hot[0]), 0);
+        __mem_alloc(rp->mem, rp->dirty, rp->cap * sizeof(rp->dirty[0]), 0);
+    }
+
+    rp->pool = pool;
+    rp->hot = hot;
+    rp->dirty = dirty;
+    rp->cap = newcap;
+    return true;
 }
 
-static inline ProfileContext *__profilecontext_getorcreate(lua_State *L){
-    ProfileContext *pc;
+static void __recordpool_freehists(RecordPool *rp){
+    for(int i = 0; i < rp->nb; ++i){
+        RecordHot *rh = &rp->hot[i];
 
-    lua_getfield(L, LUA_REGISTRYINDEX, LPROFILE_REGKEY_NAME);
+        if(rh->hist){
+            __mem_alloc(rp->histmem, rh->hist, sizeof(rh->hist[0]), 0);
+            rh->hist = NULL;
+        }
+    }
+}
+
+static void __recordpool_freeattached(RecordPool *rp){
+    for(int i = 0; i < rp->nb; ++i){
+        ProtoRecord *pr = &rp->pool[i];
+
+        if(pr->lines){
+            __mem_alloc(rp->linemem, pr->lines, pr->linenb * sizeof(pr->lines[0]), 0);
+            pr->lines = NULL;
+            pr->linenb = 0;
+        }
+    }
+
+    __recordpool_freehists(rp);
+}
+
+static inline void __recordpool_destroy(lua_State *L, RecordPool *rp){
+    __recordpool_freeattached(rp);
+    __recordpool_resize(rp, 0);
+    imap_destroy(&rp->usedmap);
+    imap_destroy(&rp->keymap);
+    imap_destroy(&rp->srcmap);
+    istr_destroy(&rp->strs);
+
+    lplog("__recordpool_destroy rp=%p\n", rp);
+}
+
+/* 调用前rp->dirty[id]>=0标记要留下的记录，返回后rp->dirty[老id]就是新id */
+static void __recordpool_clear(lua_State *L, RecordPool *rp){
+    int *remap = rp->dirty;
+    int nb = 0;
+
+    for(int i = 0; i < rp->nb; ++i){
+        ProtoRecord *pr = &rp->pool[i];
+        RecordHot *rh = &rp->hot[i];
+
+        if(remap[i] < 0){
+            if(pr->lines){
+                __mem_alloc(rp->linemem, pr->lines, pr->linenb * sizeof(pr->lines[0]), 0);
+            }
+            if(rh->hist){
+                __mem_alloc(rp->histmem, rh->hist, sizeof(rh->hist[0]), 0);
+            }
+            continue;
+        }
+
+        if(i != nb){
+            rp->pool[nb] = *pr;
+            rp->hot[nb] = *rh;
+        }
+        remap[i] = nb++;
+    }
+
+    rp->nb = nb;
+    imap_clear(&rp->usedmap);
+
+    for(int i = 0; i < rp->nb; ++i){
+        ProtoRecord *pr = &rp->pool[i];
+        LatencyHist *hist = rp->hot[i].hist;
+
+        imap_set(&rp->usedmap, (uint64_t)pr->proto, (void *)(uint64_t)i);
+
+        memset(&rp->hot[i], 0, sizeof(rp->hot[0]));
+        if(hist){
+            memset(hist, 0, sizeof(hist[0]));
+            hist->min = UINT64_MAX;
+            rp->hot[i].hist = hist;
+        }
+
+        pr->samplenb = 0;
+        pr->self_samplenb = 0;
+        pr->sampleseq = 0;
+        memset(&pr->base, 0, sizeof(pr->base));
+        if(pr->lines){
+            memset(pr->lines, 0, pr->linenb * sizeof(pr->lines[0]));
+        }
+    }
+
+    imap_clear(&rp->keymap);
+    if(rp->nb == 0){
+        imap_clear(&rp->srcmap);
+    }
+
+    rp->dirtynb = 0;
+    ++rp->generation;
+    rp->stat_dropnb = 0;
+    rp->stat_linedropnb = 0;
+    rp->stat_histdropnb = 0;
+}
+
+static int __recordpool_lookup(lua_State *L, RecordPool *rp, void *proto, lua_Debug *dbg, bool capname){
+    void *val;
+    ProtoRecord *pr;
+    uint64_t id;
+
+    if(imap_get(&rp->usedmap, (uint64_t)proto, &val)){
+        return (int)(uint64_t)val;
+    }
+
+    if(!proto){
+        ++rp->stat_dropnb;
+        return -1;
+    }
+
+    if(__mem_overbudget(rp->mem->mc)){
+        ++rp->stat_dropnb;
+        return -1;
+    }
+
+    if(!lua_getinfo(L, capname ? "nS" : "S", dbg)){
+        return -1;
+    }
+
+    if(!capname){
+        dbg->name = NULL;
+        dbg->namewhat = NULL;
+    }
+
+    if(rp->nb >= rp->cap && !__recordpool_resize(rp, rp->cap ? rp->cap * 2 : LP_RECORD_MINCAP)){
+        ++rp->stat_dropnb;
+        return -1;
+    }
+
+    pr = &rp->pool[rp->nb];
+    pr->source = istr_intern(&rp->strs, dbg->source);
+    pr->name = istr_intern(&rp->strs, dbg->name);
+    pr->namewhat = istr_intern(&rp->strs, dbg->namewhat);
+    pr->what = istr_intern(&rp->strs, dbg->what);
+    if(!pr->source || !pr->name || !pr->namewhat || !pr->what){
+        ++rp->stat_dropnb;
+        return -1;
+    }
+
+    id = rp->nb;
+    ++rp->nb;
+
+    pr->proto = proto;
+    pr->line = dbg->linedefined;
+    pr->lastline = dbg->lastlinedefined;
+    pr->linenb = 0;
+    pr->lines = NULL;
+    memset(&rp->hot[id], 0, sizeof(rp->hot[0]));
+    pr->samplenb = 0;
+    pr->self_samplenb = 0;
+    pr->sampleseq = 0;
+    pr->filtered = -1;
+    memset(&pr->base, 0, sizeof(pr->base));
+
+    if(!imap_set(&rp->usedmap, (uint64_t)proto, (void *)id)){
+        --rp->nb;
+        ++rp->stat_dropnb;
+        return -1;
+    }
+
+    lplog("__recordpool_lookup new record proto=%p,id=%lu\n", proto, id);
+    return (int)id;
+}
+
+/* 值的高SUBBITS+1位决定桶：最高位的位置选组，紧跟着的SUBBITS位选组内的桶 */
+static inline int __hist_bucket(uint64_t v){
+    int msb;
+
+    if(v < LP_HIST_SUBNB){
+        return (int)v;
+    }
+
+    msb = 63 - __builtin_clzll(v);
+    if(msb >= LP_HIST_MAXBITS){
+        return LP_HIST_BUCKETNB - 1;
+    }
+
+    return ((msb - LP_HIST_SUBBITS + 1) << LP_HIST_SUBBITS) + (int)((v >> (msb - LP_HIST_SUBBITS)) & (LP_HIST_SUBNB - 1));
+}
+
+static inline uint64_t __hist_bucketlo(int idx){
+    int group = idx >> LP_HIST_SUBBITS;
+
+    if(group == 0){
+        return (uint64_t)idx;
+    }
+
+    return (uint64_t)(LP_HIST_SUBNB + (idx & (LP_HIST_SUBNB - 1))) << (group - 1);
+}
+
+static inline void __hist_add(LatencyHist *hist, uint64_t v){
+    ++hist->counts[__hist_bucket(v)];
+    ++hist->nb;
+    hist->min = v < hist->min ? v : hist->min;
+    hist->max = v > hist->max ? v : hist->max;
+}
+
+static uint64_t __hist_quantile(LatencyHist *hist, double q){
+    uint64_t rank = (uint64_t)(q * hist->nb + 0.5);
+    uint64_t seen = 0;
+
+    rank = rank < 1 ? 1 : rank;
+    for(int i = 0; i < LP_HIST_BUCKETNB; ++i){
+        seen += hist->counts[i];
+        if(seen >= rank){
+            uint64_t hi = i + 1 < LP_HIST_BUCKETNB ? __hist_bucketlo(i + 1) - 1 : hist->max;
+            hi = hi > hist->max ? hist->max : hi;
+            return hi < hist->min ? hist->min : hi;
+        }
+    }
+
+    return hist->max;
+}
+
+static bool __recordpool_newhist(RecordPool *rp, RecordHot *rh){
+    if(__mem_overbudget(rp->mem->mc)){
+        ++rp->stat_histdropnb;
+        return false;
+    }
+
+    rh->hist = __mem_alloc(rp->histmem, NULL, 0, sizeof(rh->hist[0]));
+    if(!rh->hist){
+        ++rp->stat_histdropnb;
+        return false;
+    }
+
+    memset(rh->hist, 0, sizeof(rh->hist[0]));
+    rh->hist->min = UINT64_MAX;
+    return true;
+}
+
+static inline bool __recordpool_hasdata(RecordPool *rp, int id){
+    return rp->hot[id].callnb > 0 || rp->pool[id].samplenb > 0;
+}
+
+static inline void __recordpool_touch(RecordPool *rp, RecordHot *rh, int id){
+    if(!rh->dirty){
+        rh->dirty = 1;
+        rp->dirty[rp->dirtynb++] = id;
+    }
+}
+
+static inline void __recordpool_record(RecordPool *rp, CallFrame *cf, uint64_t total, uint64_t real){
+    RecordHot *rh;
+
+    if(cf->id < 0){
+        return;
+    }
+
+    rh = &rp->hot[cf->id];
+    __recordpool_touch(rp, rh, cf->id);
+    ++rh->callnb;
+    rh->total_nspan += total;
+    rh->real_nspan += real;
+    rh->istailcall |= cf->istailcall;
+    rh->coroutine_nspan += total - cf->yield_nspan;
+
+    if(rh->hist){
+        __hist_add(rh->hist, total);
+    }else if(rh->callnb >= rp->histafter && __recordpool_newhist(rp, rh)){
+        __hist_add(rh->hist, total);
+    }
+}
+
+static LineStat *__recordpool_growlines(RecordPool *rp, ProtoRecord *pr, int idx){
+    LineStat *lines;
+    int nb = pr->lastline > pr->line ? pr->lastline - pr->line + 1 : LP_LINE_MINCAP;
+
+    while(nb <= idx){
+        nb *= 2;
+    }
+
+    if(__mem_overbudget(rp->mem->mc)){
+        ++rp->stat_linedropnb;
+        return NULL;
+    }
+
+    lines = __mem_alloc(rp->linemem, pr->lines, pr->linenb * sizeof(pr->lines[0]), nb * sizeof(pr->lines[0]));
+    if(!lines){
+        ++rp->stat_linedropnb;
+        return NULL;
+    }
+
+    memset(lines + pr->linenb, 0, (nb - pr->linenb) * sizeof(lines[0]));
+    pr->lines = lines;
+    pr->linenb = nb;
+    return &lines[idx];
+}
+
+static inline LineStat *__recordpool_line(RecordPool *rp, int id, int line){
+    ProtoRecord *pr = &rp->pool[id];
+    int idx = line - pr->line;
+
+    if(idx < 0){
+        return NULL;
+    }
+
+    if(idx < pr->linenb){
+        return &pr->lines[idx];
+    }
+
+    return __recordpool_growlines(rp, pr, idx);
+}
+
+static inline void __recordpool_reset(lua_State *L, RecordPool *rp){
+    __recordpool_freeattached(rp);
+    imap_clear(&rp->usedmap);
+    imap_clear(&rp->keymap);
+    imap_clear(&rp->srcmap);
+    rp->nb = 0;
+    rp->dirtynb = 0;
+    ++rp->generation;
+    rp->stat_dropnb = 0;
+    rp->stat_linedropnb = 0;
+    rp->stat_histdropnb = 0;
+}
+
+/* proto/line模式下Lua函数的key：1<<63|驻留source的id<<32|linedefined，最高位不会和C函数指针撞 */
+static inline void *__recordpool_protokey(RecordPool *rp, const char *source, int linedefined){
+    IstrNode *node;
+    void *val;
+
+    /* srcmap命中后还要比一下内容，地址被别的source复用时重新驻留 */
+    source = source ? source : "";
+    node = imap_get(&rp->srcmap, (uint64_t)source, &val) ? val : NULL;
+    if(!node || strcmp(node->str, source) != 0){
+        const char *s = istr_intern(&rp->strs, source);
+
+        if(!s){
+            return NULL;
+        }
+
+        node = istr_node(s);
+        imap_set(&rp->srcmap, (uint64_t)source, node);
+    }
+
+    return (void *)(((uint64_t)1 << 63) | ((uint64_t)node->id << 32) | (uint32_t)linedefined);
+}
+
+/* 函数要在栈顶，返回NULL时丢弃这次事件；keymap按闭包地址缓存，每轮pclear清掉 */
+static LP_FORCEINLINE void *__recordpool_key(lua_State *L, RecordPool *rp, lua_Debug *dbg){
+    const void *fn = lua_topointer(L, -1);
+    void *val;
+    void *key;
+
+    if(rp->aggregate == LP_AGG_CLOSURE){
+        return (void *)fn;
+    }
+
+    if(lua_iscfunction(L, -1)){
+        return (void *)lua_tocfunction(L, -1);
+    }
+
+    if(imap_get(&rp->keymap, (uint64_t)fn, &val)){
+        return val;
+    }
+
+    if(!lua_getinfo(L, "S", dbg)){
+        return (void *)fn;
+    }
+
+    key = __recordpool_protokey(rp, dbg->source, dbg->linedefined);
+    if(key && !__mem_overbudget(rp->mem->mc)){
+        imap_set(&rp->keymap, (uint64_t)fn, key);
+    }
+
+    return key;
+}
+
+static inline int __recordpool_find(RecordPool *rp, void *proto){
+    void *val;
+
+    return imap_get(&rp->usedmap, (uint64_t)proto, &val) ? (int)(uint64_t)val : -1;
+}
+
+static inline void __edgepool_init(lua_State *L, EdgePool *ep, MemAccount *mem, MemAccount *mapmem){
+    imap_init(&ep->map, __mem_alloc, mapmem);
+    ep->cap = 0;
+    ep->nb = 0;
+    ep->pool = NULL;
+    ep->mem = mem;
+    ep->stat_dropnb = 0;
+}
+
+static bool __edgepool_resize(EdgePool *ep, int newcap){
+    EdgeRecord *pool = __mem_alloc(ep->mem, ep->pool, ep->cap * sizeof(ep->pool[0]), newcap * sizeof(ep->pool[0]));
+
+    if(!pool && newcap > 0){
+        return false;
+    }
+
+    ep->pool = pool;
+    ep->cap = newcap;
+    return true;
+}
+
+static inline void __edgepool_destroy(lua_State *L, EdgePool *ep){
+    if(ep->cap > 0){
+        __edgepool_resize(ep, 0);
+    }
+
+    imap_destroy(&ep->map);
+}
+
+static inline void __edgepool_clear(lua_State *L, EdgePool *ep){
+    imap_clear(&ep->map);
+    ep->nb = 0;
+    ep->stat_dropnb = 0;
+}
+
+static void __edgepool_record(EdgePool *ep, int caller, int callee, uint64_t total, uint64_t real){
+    uint64_t key = (uint64_t)(uint32_t)caller << 32 | (uint32_t)callee;
+    EdgeRecord *er;
+    void *val;
+
+    if(imap_get(&ep->map, key, &val)){
+        er = &ep->pool[(uint64_t)val];
+    }else{
+        if(__mem_overbudget(ep->mem->mc)
+                || (ep->nb >= ep->cap && !__edgepool_resize(ep, ep->cap ? ep->cap * 2 : LP_EDGE_MINCAP))){
+            ++ep->stat_dropnb;
+            return;
+        }
+
+        if(!imap_set(&ep->map, key, (void *)(uint64_t)ep->nb)){
+            ++ep->stat_dropnb;
+            return;
+        }
+
+        er = &ep->pool[ep->nb];
+        er->caller = caller;
+        er->callee = callee;
+        er->callnb = 0;
+        er->total_nspan = 0;
+        er->real_nspan = 0;
+        ++ep->nb;
+    }
+
+    ++er->callnb;
+    er->total_nspan += total;
+    er->real_nspan += real;
+}
+
+static inline void __cct_init(lua_State *L, CctContext *cc, MemAccount *mem){
+    imap_init(&cc->map, __mem_alloc, mem);
+    cc->enabled = false;
+    cc->maxnodes = LP_CCT_MAXNODES;
+    cc->maxdepth = LP_CCT_MAXDEPTH;
+    cc->cap = 0;
+    cc->nb = 0;
+    cc->nodes = NULL;
+    cc->mem = mem;
+    cc->stat_truncnb = 0;
+}
+
+static bool __cct_resize(CctContext *cc, int newcap){
+    CctNode *nodes = __mem_alloc(cc->mem, cc->nodes, cc->cap * sizeof(cc->nodes[0]), newcap * sizeof(cc->nodes[0]));
+
+    if(!nodes && newcap > 0){
+        return false;
+    }
+
+    cc->nodes = nodes;
+    cc->cap = newcap;
+    return true;
+}
+
+static inline void __cct_destroy(lua_State *L, CctContext *cc){
+    if(cc->cap > 0){
+        __cct_resize(cc, 0);
+    }
+
+    imap_destroy(&cc->map);
+}
+
+static int __cct_newnode(CctContext *cc, int parent, int record){
+    CctNode *cn;
+    int idx;
+
+    if(cc->nb >= cc->cap && !__cct_resize(cc, cc->cap ? cc->cap * 2 : LP_CCT_MINCAP)){
+        return -1;
+    }
+
+    idx = cc->nb++;
+    cn = &cc->nodes[idx];
+    memset(cn, 0, sizeof(cn[0]));
+    cn->record = record;
+    cn->parent = parent;
+    cn->first_child = -1;
+    cn->next_sibling = -1;
+
+    if(parent >= 0){
+        CctNode *pn = &cc->nodes[parent];
+        cn->depth = pn->depth + 1;
+        cn->next_sibling = pn->first_child;
+        pn->first_child = idx;
+    }
+
+    return idx;
+}
+
+static void __cct_reset(lua_State *L, CctContext *cc){
+    imap_clear(&cc->map);
+    cc->nb = 0;
+    cc->stat_truncnb = 0;
+
+    if(cc->enabled){
+        __cct_newnode(cc, -1, -1);
+        __cct_newnode(cc, LP_CCT_ROOT, -1);
+    }
+}
+
+static int __cct_enter(CctContext *cc, int parent, int record){
+    CctNode *pn = &cc->nodes[parent];
+    uint64_t key;
+    void *val;
+    int idx;
+
+    if(parent == LP_CCT_TRUNCATED || record < 0){
+        return LP_CCT_TRUNCATED;
+    }
+
+    for(int i = 0; i < pn->inlinenb; ++i){
+        if(pn->inlines[i].record == record){
+            return pn->inlines[i].node;
+        }
+    }
+
+    key = (uint64_t)(uint32_t)parent << 32 | (uint32_t)record;
+    if(pn->inlinenb >= LP_CCT_INLINE && imap_get(&cc->map, key, &val)){
+        return (int)(uint64_t)val;
+    }
+
+    /* 孩子要进map时先把位置留好，节点挂上树之后插入就不会失败 */
+    if(pn->depth >= cc->maxdepth || cc->nb >= cc->maxnodes || __mem_overbudget(cc->mem->mc)
+            || (pn->inlinenb >= LP_CCT_INLINE && !imap_reserve(&cc->map, imap_count(&cc->map) + 1))
+            || (idx = __cct_newnode(cc, parent, record)) < 0){
+        ++cc->stat_truncnb;
+        return LP_CCT_TRUNCATED;
+    }
+
+    /* newnode可能挪了nodes数组 */
+    pn = &cc->nodes[parent];
+    if(pn->inlinenb < LP_CCT_INLINE){
+        pn->inlines[pn->inlinenb].record = record;
+        pn->inlines[pn->inlinenb].node = idx;
+        ++pn->inlinenb;
+    }else{
+        imap_set(&cc->map, key, (void *)(uint64_t)idx);
+    }
+
+    return idx;
+}
+
+static inline void __cct_record(CctContext *cc, int node, uint64_t total, uint64_t real){
+    CctNode *cn = &cc->nodes[node];
+
+    ++cn->callnb;
+    cn->total_nspan += total;
+    cn->real_nspan += real;
+}
+
+static inline int __callstack_class(int cap){
+    return __lp_log2((uint64_t)cap / LP_STACK_MINCAP);
+}
+
+static inline int __callstack_fitclass(int depth){
+    int cls = depth <= LP_STACK_MINCAP ? 0 : __lp_log2((uint64_t)(depth - 1) / LP_STACK_MINCAP) + 1;
+
+    return cls < LP_STACK_CLASSNB ? cls : LP_STACK_CLASSNB - 1;
+}
+
+static bool __callstack_resize(lua_State *L, CallStack *cs, int cls){
+    int newcap = LP_STACK_MINCAP << cls;
+    CallFrame *stk;
+
+    stk = __mem_alloc(cs->mem, cs->stk, cs->cap * sizeof(cs->stk[0]), newcap * sizeof(cs->stk[0]));
+    if(!stk){
+        return false;
+    }
+
+    cs->stk = stk;
+    cs->cap = newcap;
+    return true;
+}
+
+static inline void __callstack_init(lua_State *L, CallStack *cs, MemAccount *mem){
+    cs->nb = 0;
+    cs->maxnb = 0;
+    cs->cap = 0;
+    cs->ref = 0;
+    cs->running = false;
+    cs->nextnode = NULL;
+    cs->mem = mem;
+    cs->stk = NULL;
+
+    lplog("__callstack_init cs=%p\n", cs);
+}
+
+static inline void __callstack_destroy(lua_State *L, CallStack *cs){
+    if(cs->stk){
+        __mem_alloc(cs->mem, cs->stk, cs->cap * sizeof(cs->stk[0]), 0);
+    }
+
+    lplog("__callstack_destroy cs=%p\n", cs);
+}
+
+static bool __callstack_grow(lua_State *L, CallStack *cs){
+    int cls = cs->cap ? __callstack_class(cs->cap) + 1 : 0;
+
+    return cls < LP_STACK_CLASSNB && __callstack_resize(L, cs, cls);
+}
+
+static inline CallFrame *__callstack_push(lua_State *L, CallStack *cs){
+    if(cs->nb >= cs->cap && !__callstack_grow(L, cs)){
+        return NULL;
+    }
+
+    if(cs->nb >= cs->maxnb){
+        cs->maxnb = cs->nb + 1;
+    }
+
+    return &cs->stk[cs->nb++];
+}
+
+static inline CallFrame *__callstack_pop(lua_State *L, CallStack *cs){
+    return cs->nb > 0 ? (--cs->nb, &cs->stk[cs->nb]) : NULL;
+}
+
+static inline CallFrame *__callstack_top(lua_State *L, CallStack *cs){
+    return cs->nb > 0 ? &cs->stk[cs->nb - 1] : NULL;
+}
+
+static inline CallFrame *__callstack_parent(lua_State *L, CallStack *cs){
+    return cs->nb > 1 ? &cs->stk[cs->nb - 2] : NULL;
+}
+
+static inline int __callstack_callerid(lua_State *L, CallStack *cs){
+    for(int i = cs->nb - 1; i >= 0; --i){
+        if(!cs->stk[i].filtered){
+            return cs->stk[i].id;
+        }
+    }
+
+    return -1;
+}
+
+static inline void __callstackpool_pushfree(CallStackPool *csp, CallStack *cs){
+    int cls = cs->cap ? __callstack_class(cs->cap) : 0;
+
+    cs->nextnode = csp->freelist[cls];
+    csp->freelist[cls] = cs;
+    ++csp->freenb;
+}
+
+static CallStack *__callstackpool_popfree(lua_State *L, CallStackPool *csp){
+    CallStack *cs = NULL;
+    int cls;
+
+    for(cls = csp->sizehint; cls < LP_STACK_CLASSNB && !cs; ++cls){
+        cs = csp->freelist[cls];
+    }
+
+    for(cls = csp->sizehint - 1; cls >= 0 && !cs; --cls){
+        cs = csp->freelist[cls];
+    }
+
+    if(cs){
+        cls = cs->cap ? __callstack_class(cs->cap) : 0;
+        csp->freelist[cls] = cs->nextnode;
+        cs->nextnode = NULL;
+        --csp->freenb;
+        return cs;
+    }
+
+    cs = __mem_alloc(csp->mem, NULL, 0, sizeof(cs[0]));
+    if(!cs){
+        return NULL;
+    }
+
+    __callstack_init(L, cs, csp->mem);
+    __callstack_resize(L, cs, csp->sizehint);
+
+    lplog("__callstackpool_popfree new csp=%p,cs=%p,cap=%d\n", csp, cs, cs->cap);
+    return cs;
+}
+
+static inline CallStack *__callstackpool_acquire(lua_State *L, CallStackPool *csp, void *key){
+    void *val;
+    CallStack *cs;
+
+    if(imap_get(&csp->usedmap, (uint64_t)key, &val)){
+        cs = val;
+    }else{
+        cs = __callstackpool_popfree(L, csp);
+        if(!cs){
+            return NULL;
+        }
+
+        if(!imap_set(&csp->usedmap, (uint64_t)key, (void *)cs)){
+            __callstackpool_pushfree(csp, cs);
+            return NULL;
+        }
+
+        ++csp->usednb;
+        csp->stat_usednb = csp->usednb > csp->stat_usednb ? csp->usednb : csp->stat_usednb;
+
+        if(csp->lastkey == key){
+            csp->lastcs = cs;
+        }
+
+        lplog("__callstackpool_acquire csp=%p,key=%p\n", csp, key);
+    }
+
+    ++cs->ref;
+    return cs;
+}
+
+static inline CallStack *__callstackpool_get(lua_State *L, CallStackPool *csp, void *key){
+    void *val;
+
+    if(key != csp->lastkey){
+        csp->lastkey = key;
+        csp->lastcs = imap_get(&csp->usedmap, (uint64_t)key, &val) ? (CallStack *)val : NULL;
+    }
+
+    return csp->lastcs;
+}
+
+static inline void __callstackpool_release(lua_State *L, CallStackPool *csp, void *key){
+    void *val;
+    CallStack *cs;
+
+    if(imap_get(&csp->usedmap, (uint64_t)key, &val)){
+        cs = val;
+        --cs->ref;
+
+        if(cs->ref <= 0){
+            imap_remove(&csp->usedmap, (uint64_t)key);
+            if(csp->lastcs == cs){
+                csp->lastkey = NULL;
+                csp->lastcs = NULL;
+            }
+
+            if(cs->running){
+                cs->running = false;
+                --csp->runningnb;
+            }
+
+            if(cs->maxnb > 0){
+                int cls = __callstack_fitclass(cs->maxnb);
+                csp->sizehint = cls >= csp->sizehint ? cls : csp->sizehint - 1;
+            }
+
+            cs->nb = 0;
+            cs->maxnb = 0;
+            cs->ref = 0;
+            __callstackpool_pushfree(csp, cs);
+            --csp->usednb;
+
+            lplog("__callstackpool_release csp=%p,key=%p\n", csp, key);
+        }
+    }
+}
+
+static inline void __callstackpool_init(lua_State *L, CallStackPool *csp, MemAccount *mem, MemAccount *mapmem){
+    imap_init(&csp->usedmap, __mem_alloc, mapmem);
+    csp->mem = mem;
+    csp->usednb = 0;
+    csp->freenb = 0;
+    csp->runningnb = 0;
+    csp->stat_usednb = 0;
+    csp->lastkey = NULL;
+    csp->lastcs = NULL;
+    csp->sizehint = 0;
+    memset(csp->freelist, 0, sizeof(csp->freelist));
+
+    lplog("__callstackpool_init csp=%p\n", csp);
+}
+
+typedef struct StackWalkArg {
+    lua_State *L;
+    CallStackPool *csp;
+    int cls;
+    bool ok;
+} StackWalkArg;
+
+static void __callstackpool_reserveusedcb(void *ud, uint64_t key, void *val){
+    StackWalkArg *arg = ud;
+    CallStack *cs = val;
+
+    if(cs->cap < (LP_STACK_MINCAP << arg->cls) && !__callstack_resize(arg->L, cs, arg->cls)){
+        arg->ok = false;
+    }
+}
+
+static bool __callstackpool_reserve(lua_State *L, CallStackPool *csp, int stacks, int depth){
+    StackWalkArg arg = {L, csp, __callstack_fitclass(depth), true};
+    CallStack *small = NULL;
+    CallStack *cs;
+
+    csp->sizehint = arg.cls > csp->sizehint ? arg.cls : csp->sizehint;
+    if(!imap_reserve(&csp->usedmap, stacks)){
+        return false;
+    }
+
+    imap_foreach(&csp->usedmap, __callstackpool_reserveusedcb, &arg);
+
+    for(int cls = 0; cls < arg.cls; ++cls){
+        while((cs = csp->freelist[cls]) != NULL){
+            csp->freelist[cls] = cs->nextnode;
+            cs->nextnode = small;
+            small = cs;
+            --csp->freenb;
+        }
+    }
+
+    while((cs = small) != NULL){
+        small = cs->nextnode;
+        arg.ok = __callstack_resize(L, cs, arg.cls) && arg.ok;
+        __callstackpool_pushfree(csp, cs);
+    }
+
+    while(arg.ok && csp->usednb + csp->freenb < stacks){
+        cs = __mem_alloc(csp->mem, NULL, 0, sizeof(cs[0]));
+        if(!cs){
+            return false;
+        }
+
+        __callstack_init(L, cs, csp->mem);
+        arg.ok = __callstack_resize(L, cs, arg.cls);
+        __callstackpool_pushfree(csp, cs);
+    }
+
+    return arg.ok;
+}
+
+static void __callstackpool_trimusedcb(void *ud, uint64_t key, void *val){
+    StackWalkArg *arg = ud;
+    CallStack *cs = val;
+
+    if(cs->nb == 0 && cs->cap > 0){
+        __callstack_destroy(arg->L, cs);
+        cs->stk = NULL;
+        cs->cap = 0;
+    }else if(cs->nb > 0 && __callstack_fitclass(cs->nb) < __callstack_class(cs->cap)){
+        __callstack_resize(arg->L, cs, __callstack_fitclass(cs->nb));
+    }
+}
+
+static void __callstackpool_trim(lua_State *L, CallStackPool *csp){
+    StackWalkArg arg = {L, csp, 0, true};
+    CallStack *cs;
+
+    for(int cls = 0; cls < LP_STACK_CLASSNB; ++cls){
+        while((cs = csp->freelist[cls]) != NULL){
+            csp->freelist[cls] = cs->nextnode;
+            __callstack_destroy(L, cs);
+            __mem_alloc(csp->mem, cs, sizeof(cs[0]), 0);
+            --csp->freenb;
+        }
+    }
+
+    imap_foreach(&csp->usedmap, __callstackpool_trimusedcb, &arg);
+    imap_trim(&csp->usedmap);
+    csp->sizehint = 0;
+}
+
+static inline void __callstackpool_freeusednodecb(void *ud, uint64_t key, void *val){
+    CallStack *cs = val;
+
+    __callstack_destroy(NULL, cs);
+    __mem_alloc(cs->mem, cs, sizeof(cs[0]), 0);
+
+    lplog("__callstackpool_freeusednodecb key=%lu,val=%p\n", key, val);
+}
+
+static inline void __callstackpool_destroy(lua_State *L, CallStackPool *csp){
+    CallStack *cs;
+
+    for(int cls = 0; cls < LP_STACK_CLASSNB; ++cls){
+        while((cs = csp->freelist[cls]) != NULL){
+            csp->freelist[cls] = cs->nextnode;
+            __callstack_destroy(L, cs);
+            __mem_alloc(csp->mem, cs, sizeof(cs[0]), 0);
+        }
+    }
+
+    imap_foreach(&csp->usedmap, __callstackpool_freeusednodecb, NULL);
+    imap_destroy(&csp->usedmap);
+
+    lplog("__callstackpool_destroy csp=%p\n", csp);
+}
+
+static inline void __profilecontext_init(lua_State *L, ProfileContext *pc){
+    MemAccount *acc = pc->mem.accounts;
+
+    __mem_init(L, &pc->mem);
+    acc[LP_MEM_CONTEXT].used = sizeof(pc[0]);
+    pc->mem.total = sizeof(pc[0]);
+
+    __callstackpool_init(L, &pc->stacks, &acc[LP_MEM_STACKS], &acc[LP_MEM_MAPS]);
+    __recordpool_init(L, &pc->records, &acc[LP_MEM_RECORDS], &acc[LP_MEM_MAPS],
+            &acc[LP_MEM_STRINGS], &acc[LP_MEM_LINES], &acc[LP_MEM_HISTS]);
+    __edgepool_init(L, &pc->edges, &acc[LP_MEM_EDGES], &acc[LP_MEM_EDGES]);
+    __cct_init(L, &pc->cct, &acc[LP_MEM_CCT]);
+    pc->stat_lossnspan = 0;
+    pc->stat_realnspan = 0;
+    pc->stat_yieldnspan = 0;
+    pc->stat_eventnb = 0;
+    pc->stat_samplenb = 0;
+    __clock_init(&pc->clock);
+    __timer_init(&pc->timer);
+    __overhead_init(&pc->overhead);
+    memset(&pc->filter, 0, sizeof(pc->filter));
+    pc->line.sample = false;
+    pc->line.id = -1;
+    pc->line.lastkey = NULL;
+    pc->line.lastid = -1;
+    pc->maphash = IMAP_HASH_FIBONACCI;
+    pc->compensate = false;
+    pc->mode = LP_MODE_TRACE;
+    pc->sample_every = LP_SAMPLE_EVERY;
+    pc->enabled = true;
+    pc->proto_yield = NULL;
+    pc->proto_yieldkey = NULL;
+    pc->trace_tailcall = false;
+    pc->capture_name = LP_ENABLE_CAPTURENAME;
+    pc->graph = false;
+
+    lplog("__profilecontext_init pc=%p\n", pc);
+}
+
+static inline void __profilecontext_destroy(lua_State *L, ProfileContext *pc){
+    __timer_stop(&pc->timer);
+    __recordpool_destroy(L, &pc->records);
+    __edgepool_destroy(L, &pc->edges);
+    __cct_destroy(L, &pc->cct);
+    __callstackpool_destroy(L, &pc->stacks);
+
+    lplog("__profilecontext_destroy pc=%p\n", pc);
+}
+
+static ProfileContext *__profilecontext_getorcreate(lua_State *L);
+
+static int __profilecontext_gc(lua_State *L){
+    void *ud;
+    lua_Alloc af = lua_getallocf(L, &ud);
+    ProfileContext *pc = *(ProfileContext **)lua_touserdata(L, -1);
+    __profilecontext_destroy(L, pc);
+    af(ud, pc, sizeof(pc[0]), 0);
+
+    lplog("__profilecontext_gc pc=%p\n", pc);
+    return 0;
+}
+
+static inline ProfileContext *__profilecontext_get(lua_State *L){
+    ProfileContext **p;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &LPROFILE_REGKEY);
+    p = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    return p ? *p : NULL;
+}
+
+static inline ProfileContext *__profilecontext_getorcreate(lua_State *L){
+    ProfileContext *pc;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &LPROFILE_REGKEY);
+    if(lua_isnil(L, -1)){
+        void *ud;
+        lua_Alloc af = lua_getallocf(L, &ud);
+        ProfileContext **p;
+
+        lua_pop(L, 1);
+        pc = af(ud, NULL, 0, sizeof(pc[0]));
+        __profilecontext_init(L, pc);
+        p = lua_newuserdata(L, sizeof(p[0]));
+        *p = pc;
+        if(luaL_newmetatable(L, LPROFILE_METATBL_NAME)){
+            lua_pushcfunction(L, __profilecontext_gc);
+            lua_setfield(L, -2, "__gc");
+        }
+
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &LPROFILE_REGKEY);
+    }
+
+    pc = *(ProfileContext **)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return pc;
+}
+
+/* 挂着的协程不会被回收，定时器信号和换hook时不会碰到野指针 */
+static void __profilecontext_anchor(lua_State *L, bool anchor){
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &LPROFILE_THREADSKEY);
+    if(lua_isnil(L, -1)){
+        lua_pop(L, 1);
+        if(!anchor){
+            return;
+        }
+
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &LPROFILE_THREADSKEY);
+    }
+
+    lua_pushthread(L);
+    if(anchor){
+        lua_pushboolean(L, 1);
+    }else{
+        lua_pushnil(L);
+    }
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+static bool __filter_matchany(lua_State *L, const char *field, const char *source){
+    bool matched = false;
+    int nb;
+
+    lua_getfield(L, -1, field);
+    nb = (int)lua_rawlen(L, -1);
+
+    for(int i = 1; i <= nb && !matched; ++i){
+        lua_getfield(L, -2, "find");
+        lua_pushstring(L, source);
+        lua_rawgeti(L, -3, i);
+        if(lua_pcall(L, 2, 1, 0) == LUA_OK){
+            matched = !lua_isnil(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pop(L, 1);
+    return matched;
+}
+
+static inline void *__profilecontext_yieldkey(ProfileContext *pc){
+    return pc->records.aggregate == LP_AGG_CLOSURE ? pc->proto_yield : pc->proto_yieldkey;
+}
+
+static bool __filter_eval(lua_State *L, ProfileContext *pc, ProtoRecord *pr){
+    FilterContext *fc = &pc->filter;
+    bool filtered;
+
+    /* 被当作yield的函数不能过滤，否则协程挂起时间统计不到 */
+    if(pc->proto_yield && pr->proto == __profilecontext_yieldkey(pc)){
+        return false;
+    }
+
+    if(fc->exclude_c && strcmp(pr->what, "C") == 0){
+        return true;
+    }
+
+    if(fc->includenb <= 0 && fc->excludenb <= 0){
+        return false;
+    }
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &LPROFILE_FILTERKEY);
+    if(!lua_istable(L, -1)){
+        lua_pop(L, 1);
+        return false;
+    }
+
+    filtered = fc->includenb > 0 && !__filter_matchany(L, "include", pr->source);
+    if(!filtered && fc->excludenb > 0){
+        filtered = __filter_matchany(L, "exclude", pr->source);
+    }
+
+    lua_pop(L, 1);
+
+    lplog("__filter_eval proto=%p,source=%s,filtered=%d\n", pr->proto, pr->source, filtered);
+    return filtered;
+}
+
+static inline bool __profilecontext_filtered(lua_State *L, ProfileContext *pc, int id){
+    ProtoRecord *pr;
+
+    if(!pc->filter.enabled || id < 0){
+        return false;
+    }
+
+    pr = &pc->records.pool[id];
+    if(pr->filtered < 0){
+        pr->filtered = __filter_eval(L, pc, pr);
+    }
+
+    return pr->filtered;
+}
+
+/* 所有hook变体共用的实现，参数都是编译期常量 */
+static LP_FORCEINLINE void __lua_hook(lua_State *L, lua_Debug *ar,
+        const int tailcall, const int yield, const int clock, const int capname){
+    uint64_t event_hpc;
+    int event = ar->event;
+    lua_Debug dbg;
+    int ret;
+    void *key;
+    ProfileContext *pc = __profilecontext_get(L);
+    CallStack *cs;
+
+    if(!pc || !pc->enabled){
+        return;
+    }
+
+    event_hpc = gethpc(clock);
+    ++pc->stat_eventnb;
+
+    cs = __callstackpool_get(L, &pc->stacks, L);
+    if(!cs || !cs->running){
+        return;
+    }
+
+    ret = lua_getstack(L, 0, &dbg);
+    if(!ret){
+        return;
+    }
+
+    ret = lua_getinfo(L, "f", &dbg);
+    if(!ret){
+        return;
+    }
+
+    key = __recordpool_key(L, &pc->records, &dbg);
+
+    lplog("lua_hook_cb key=%p,event=%d\n", key, event);
+
+    if(event == LUA_HOOKCALL || (tailcall && event == LUA_HOOKTAILCALL)){
+        uint64_t hpc;
+        int evt = event == LUA_HOOKTAILCALL ? LP_EVT_TAILCALL : LP_EVT_CALL;
+        int id = __recordpool_lookup(L, &pc->records, key, &dbg, capname);
+        CallFrame *cf = __callstack_push(L, cs);
+        CallFrame *precf;
+
+        if(!cf){
+            return;
+        }
+
+        precf = __callstack_parent(L, cs);
+        cf->id = id;
+        cf->istailcall = evt == LP_EVT_TAILCALL;
+        cf->filtered = __profilecontext_filtered(L, pc, id);
+        cf->sub_nspan = 0;
+        cf->yield_nspan = 0;
+        cf->loss_nspan = 0;
+
+        if(pc->cct.enabled){
+            int parent = precf ? precf->node : LP_CCT_ROOT;
+            cf->node = cf->filtered ? parent : __cct_enter(&pc->cct, parent, id);
+        }
+
+        hpc = gethpc(clock);
+        cf->start_hpc = hpc;
+
+        if(precf){
+            if(pc->compensate){
+                precf->loss_nspan += hpc - event_hpc + pc->overhead.unmeasured[evt];
+            }else if(!cf->filtered){
+                precf->sub_nspan += hpc - event_hpc;
+            }
+        }
+
+        pc->stat_lossnspan += hpc - event_hpc;
+        __overhead_record(&pc->overhead, evt, hpc - event_hpc);
+    }else if(event == LUA_HOOKTAILCALL){
+        uint64_t hpc;
+        CallFrame *cf = __callstack_top(L, cs);
+        if(cf){
+            cf->id = __recordpool_lookup(L, &pc->records, key, &dbg, capname);
+            cf->istailcall = 1;
+            cf->filtered = __profilecontext_filtered(L, pc, cf->id);
+
+            if(pc->cct.enabled){
+                CallFrame *precf = __callstack_parent(L, cs);
+                int parent = precf ? precf->node : LP_CCT_ROOT;
+                cf->node = cf->filtered ? parent : __cct_enter(&pc->cct, parent, cf->id);
+            }
+        }
+
+        hpc = gethpc(clock);
+        if(cf && pc->compensate){
+            cf->loss_nspan += hpc - event_hpc + pc->overhead.unmeasured[LP_EVT_TAILCALL];
+        }
+
+        pc->stat_lossnspan += hpc - event_hpc;
+        __overhead_record(&pc->overhead, LP_EVT_TAILCALL, hpc - event_hpc);
+    }else if(event == LUA_HOOKRET){
+        uint64_t hpc;
+        uint64_t end;
+        CallFrame *cf;
+        CallFrame *precf;
+        int id = __recordpool_find(&pc->records, key);
+        bool first = true;
+        uint64_t retloss = pc->overhead.unmeasured[LP_EVT_RET];
+
+        /* 无论是不是tailcall，ret必须匹配得上callstack的栈顶，否则丢弃 */
+        while((cf = __callstack_pop(L, cs)) != NULL && cf->id != id){
+            lplog("lua_hook_cb proto not match this=%p,id=%d,recorded=%d\n", key, id, cf->id);
+        }
+
+        if(!cf){
+            lplog("lua_hook_cb proto no call frame this=%p\n", key);
+            return;
+        }
+
+        do {
+            uint64_t total;
+            uint64_t real;
+
+            if(cf->filtered){
+                precf = __callstack_top(L, cs);
+                hpc = gethpc(clock);
+                if(precf){
+                    precf->sub_nspan += cf->sub_nspan;
+                    if(pc->compensate){
+                        precf->loss_nspan += cf->loss_nspan + (hpc - event_hpc) + retloss;
+                        retloss = 0;
+                    }
+
+                    if(yield){
+                        precf->yield_nspan += cf->yield_nspan;
+                    }
+                }
+
+                first = false;
+                continue;
+            }
+
+            total = event_hpc - cf->start_hpc;
+
+            /* 这次ret量不到的开销只从栈顶frame扣，父frame通过loss间接扣掉 */
+            if(pc->compensate){
+                uint64_t loss = cf->loss_nspan + retloss;
+
+                total = total > loss ? total - loss : 0;
+                retloss = 0;
+
+                if(total < cf->sub_nspan){
+                    total = cf->sub_nspan;
+                }
+            }
+
+            real = total > cf->sub_nspan ? total - cf->sub_nspan : 0;
+
+            if(yield && first && key == __profilecontext_yieldkey(pc)){
+                cf->yield_nspan += real;
+                pc->stat_yieldnspan += real;
+            }
+
+            __recordpool_record(&pc->records, cf, total, real);
+            if(pc->cct.enabled){
+                __cct_record(&pc->cct, cf->node, total, real);
+            }
+            first = false;
+
+            precf = __callstack_top(L, cs);
+            if(pc->graph && cf->id >= 0){
+                int caller = precf && !precf->filtered ? precf->id : __callstack_callerid(L, cs);
+                if(caller >= 0){
+                    __edgepool_record(&pc->edges, caller, cf->id, total, real);
+                }
+            }
+
+            /* tailcall链上的父frame也在这次ret结束，它的窗口只到event_hpc，这次ret量到的开销不在里面 */
+            hpc = gethpc(clock);
+            end = tailcall && cf->istailcall ? event_hpc : hpc;
+            if(precf){
+                if(pc->compensate){
+                    precf->sub_nspan += total;
+                    precf->loss_nspan += end - cf->start_hpc > total ? end - cf->start_hpc - total : 0;
+                }else{
+                    precf->sub_nspan += end - cf->start_hpc;
+                }
+
+                if(yield){
+                    precf->yield_nspan += cf->yield_nspan;
+                }
+            }
+
+            pc->stat_realnspan += real;
+
+        }while(tailcall && cf->istailcall && (cf = __callstack_pop(L, cs)) != NULL);
+
+        pc->stat_lossnspan += hpc - event_hpc;
+        __overhead_record(&pc->overhead, LP_EVT_RET, hpc - event_hpc);
+    }
+}
+
+#define LP_HOOK_NAME(tc, yd, ck, cn) lua_hook_cb_##tc##_##yd##_##ck##_##cn
+
+#define LP_HOOK_DEFINE(tc, yd, ck, cn) \
+    static void LP_HOOK_NAME(tc, yd, ck, cn)(lua_State *L, lua_Debug *ar){ \
+        __lua_hook(L, ar, (tc) && LP_ENABLE_TRACETAILCALL, (yd) && LP_ENABLE_YIELD, ck, (cn) && LP_ENABLE_CAPTURENAME); \
+    }
+
+#define LP_HOOK_ENTRY(tc, yd, ck, cn) [tc][yd][ck][cn] = LP_HOOK_NAME(tc, yd, ck, cn),
+
+#define LP_HOOK_CLOCKS(X, tc, yd, cn) \
+    X(tc, yd, LP_CLOCK_REALTIME, cn) \
+    X(tc, yd, LP_CLOCK_MONOTONIC, cn) \
+    X(tc, yd, LP_CLOCK_MONOTONIC_COARSE, cn) \
+    X(tc, yd, LP_CLOCK_THREAD_CPUTIME, cn) \
+    X(tc, yd, LP_CLOCK_TSC, cn)
+
+#define LP_HOOK_VARIANTS(X) \
+    LP_HOOK_CLOCKS(X, 0, 0, 0) \
+    LP_HOOK_CLOCKS(X, 0, 0, 1) \
+    LP_HOOK_CLOCKS(X, 0, 1, 0) \
+    LP_HOOK_CLOCKS(X, 0, 1, 1) \
+    LP_HOOK_CLOCKS(X, 1, 0, 0) \
+    LP_HOOK_CLOCKS(X, 1, 0, 1) \
+    LP_HOOK_CLOCKS(X, 1, 1, 0) \
+    LP_HOOK_CLOCKS(X, 1, 1, 1)
+
+LP_HOOK_VARIANTS(LP_HOOK_DEFINE)
+
+static const lua_Hook lp_hooks[2][2][LP_CLOCK_NB][2] = {
+    LP_HOOK_VARIANTS(LP_HOOK_ENTRY)
+};
+
+static void __profilecontext_sample(lua_State *L, ProfileContext *pc){
+    RecordPool *rp = &pc->records;
+    lua_Debug dbg;
+    uint64_t seq;
+    int level;
+    bool self = true;
+
+    seq = ++pc->stat_samplenb;
+
+    for(level = 0; level < LP_SAMPLE_MAXDEPTH && lua_getstack(L, level, &dbg); ++level){
+        ProtoRecord *pr;
+        void *proto;
+        int id;
+
+        if(!lua_getinfo(L, "f", &dbg)){
+            break;
+        }
+
+        proto = __recordpool_key(L, rp, &dbg);
+        id = __recordpool_lookup(L, rp, proto, &dbg, pc->capture_name);
+        lua_pop(L, 1);
+
+        if(id < 0 || __profilecontext_filtered(L, pc, id)){
+            continue;
+        }
+
+        pr = &rp->pool[id];
+        __recordpool_touch(rp, &rp->hot[id], id);
+        if(self){
+            ++pr->self_samplenb;
+            self = false;
+
+            if(pc->line.sample && lua_getinfo(L, "l", &dbg) && dbg.currentline >= 0){
+                LineStat *ls = __recordpool_line(rp, id, dbg.currentline);
+                if(ls){
+                    ++ls->samplenb;
+                }
+            }
+        }
+
+        if(pr->sampleseq != seq){
+            pr->sampleseq = seq;
+            ++pr->samplenb;
+        }
+    }
+
+    lplog("__profilecontext_sample seq=%lu,depth=%d\n", seq, level);
+}
+
+static void lua_hook_sample(lua_State *L, lua_Debug *ar){
+    ProfileContext *pc = __profilecontext_get(L);
+    CallStack *cs;
+
+    if(!pc || !pc->enabled){
+        return;
+    }
+
+    cs = __callstackpool_get(L, &pc->stacks, L);
+    if(!cs || !cs->running){
+        return;
+    }
+
+    __profilecontext_sample(L, pc);
+}
+
+/* 新建的协程可能继承了这个一次性hook，先摘掉 */
+static void lua_hook_timer(lua_State *L, lua_Debug *ar){
+    ProfileContext *pc = __profilecontext_get(L);
+    CallStack *cs;
+
+    lua_sethook(L, NULL, 0, 0);
+
+    if(!pc){
+        return;
+    }
+
+    __timer_disarm(&pc->timer);
+
+    if(!pc->enabled){
+        return;
+    }
+
+    cs = __callstackpool_get(L, &pc->stacks, L);
+    if(!cs || !cs->running){
+        return;
+    }
+
+    __profilecontext_sample(L, pc);
+}
+
+static void lua_hook_line(lua_State *L, lua_Debug *ar){
+    ProfileContext *pc = __profilecontext_get(L);
+    LineContext *lc;
+    RecordPool *rp;
+    CallStack *cs;
+    LineStat *ls;
+    uint64_t hpc;
+    void *key;
+    int id;
+
+    if(!pc || !pc->enabled){
+        return;
+    }
+
+    hpc = gethpc(pc->clock.source);
+    ++pc->stat_eventnb;
+
+    lc = &pc->line;
+    rp = &pc->records;
+    if(lc->id >= 0){
+        ls = __recordpool_line(rp, lc->id, lc->line);
+        if(ls){
+            ls->nspan += hpc - lc->start_hpc;
+        }
+        lc->id = -1;
+    }
+
+    cs = __callstackpool_get(L, &pc->stacks, L);
+    if(!cs || !cs->running){
+        return;
+    }
+
+    if(!lua_getinfo(L, "f", ar)){
+        return;
+    }
+
+    key = __recordpool_key(L, rp, ar);
+    if(key == lc->lastkey && lc->lastid >= 0){
+        id = lc->lastid;
+    }else{
+        id = __recordpool_lookup(L, rp, key, ar, pc->capture_name);
+        lc->lastkey = key;
+        lc->lastid = id;
+    }
+    lua_pop(L, 1);
+
+    if(id < 0 || __profilecontext_filtered(L, pc, id)){
+        return;
+    }
+
+    ls = __recordpool_line(rp, id, ar->currentline);
+    if(!ls){
+        return;
+    }
+
+    ++ls->hitnb;
+    lc->id = id;
+    lc->line = ar->currentline;
+    lc->start_hpc = gethpc(pc->clock.source);
+}
+
+static int __overhead_noop(lua_State *L){
+    return 0;
+}
+
+static void __overhead_calibhook(lua_State *L, lua_Debug *ar){
+    ProfileContext *pc = __profilecontext_get(L);
+    uint64_t hpc;
+
+    if(!pc){
+        return;
+    }
+
+    hpc = gethpc(pc->clock.source);
+    pc->overhead.calib_measured += gethpc(pc->clock.source) - hpc;
+}
+
+static uint64_t __overhead_run(lua_State *L, ProfileContext *pc, int mask){
+    uint64_t begin;
+    uint64_t end;
+
+    lua_sethook(L, mask ? __overhead_calibhook : NULL, mask, 0);
+    pc->overhead.calib_measured = 0;
+
+    begin = gethpc(pc->clock.source);
+    for(int i = 0; i < LP_CALIB_LOOP; ++i){
+        lua_pushcfunction(L, __overhead_noop);
+        lua_call(L, 0, 0);
+    }
+    end = gethpc(pc->clock.source);
+
+    lua_sethook(L, NULL, 0, 0);
+
+    return end - begin > pc->overhead.calib_measured ? end - begin - pc->overhead.calib_measured : 0;
+}
+
+static void __overhead_calibrate(lua_State *L, ProfileContext *pc){
+    OverheadContext *oc = &pc->overhead;
+    uint64_t calls[LP_CALIB_ROUND];
+    uint64_t rets[LP_CALIB_ROUND];
+
+    for(int i = 0; i < LP_CALIB_ROUND; ++i){
+        uint64_t plain = __overhead_run(L, pc, 0);
+        uint64_t call = __overhead_run(L, pc, LUA_MASKCALL);
+        uint64_t ret = __overhead_run(L, pc, LUA_MASKRET);
+
+        calls[i] = call > plain ? (call - plain) / LP_CALIB_LOOP : 0;
+        rets[i] = ret > plain ? (ret - plain) / LP_CALIB_LOOP : 0;
+    }
+
+    oc->unmeasured[LP_EVT_CALL] = __overhead_sortmedian(calls, LP_CALIB_ROUND);
+    oc->unmeasured[LP_EVT_RET] = __overhead_sortmedian(rets, LP_CALIB_ROUND);
+    oc->unmeasured[LP_EVT_TAILCALL] = oc->unmeasured[LP_EVT_CALL];
+    oc->calibrated = true;
+
+    lplog("__overhead_calibrate call=%lu,ret=%lu\n", oc->unmeasured[LP_EVT_CALL], oc->unmeasured[LP_EVT_RET]);
+}
+
+static inline void __profilecontext_sethook(lua_State *L, ProfileContext *pc){
+    lua_Hook hook;
+
+    if(pc->mode == LP_MODE_SAMPLE){
+        lua_sethook(L, lua_hook_sample, LUA_MASKCOUNT, pc->sample_every);
+        return;
+    }
+
+    if(pc->mode == LP_MODE_TIMER){
+        lua_sethook(L, NULL, 0, 0);
+        return;
+    }
+
+    if(pc->mode == LP_MODE_LINE){
+        lua_sethook(L, lua_hook_line, LUA_MASKLINE, 0);
+        return;
+    }
+
+    hook = lp_hooks[pc->trace_tailcall][pc->proto_yield != NULL][pc->clock.source][pc->capture_name];
+    lua_sethook(L, hook, LUA_MASKCALL | LUA_MASKRET, 0);
+}
+
+static void __profilecontext_refreshhook(lua_State *L, ProfileContext *pc){
+    lua_State *co;
+    CallStack *cs;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &LPROFILE_THREADSKEY);
     if(lua_isnil(L, -1)){
-        void *ud;
-        lua_Alloc af = lua_getallocf(L, &ud);
-        ProfileContext **p;
+        lua_pop(L, 1);
+        return;
+    }
+
+    lua_pushnil(L);
+    while(lua_next(L, -2)){
+        co = lua_tothread(L, -2);
+        cs = co ? __callstackpool_get(L, &pc->stacks, co) : NULL;
+        if(cs && cs->running){
+            __profilecontext_sethook(co, pc);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+/* pbegin{mode="trace"|"sample"|"timer"|"line", every=N, hz=N, timer="cpu"|"wall", lines=bool, compensate=bool} */
+static int pbegin(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    CallStack *cs;
+    int mode = pc->mode;
+    int every = pc->sample_every;
+    int hz = pc->timer.hz;
+    int clock = pc->timer.clock;
+    bool compensate = pc->compensate;
+    bool lines = pc->line.sample;
+
+    if(!lua_isnoneornil(L, 1)){
+        luaL_checktype(L, 1, LUA_TTABLE);
+
+        lua_getfield(L, 1, "mode");
+        if(!lua_isnil(L, -1)){
+            mode = luaL_checkoption(L, -1, NULL, lp_mode_names);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "every");
+        if(!lua_isnil(L, -1)){
+            lua_Integer n = luaL_checkinteger(L, -1);
+            luaL_argcheck(L, n > 0 && n <= INT_MAX, 1, "every must be positive");
+            every = (int)n;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "hz");
+        if(!lua_isnil(L, -1)){
+            lua_Integer n = luaL_checkinteger(L, -1);
+            luaL_argcheck(L, n > 0 && n <= 1000000, 1, "hz out of range");
+            hz = (int)n;
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "timer");
+        if(!lua_isnil(L, -1)){
+            clock = luaL_checkoption(L, -1, NULL, lp_timer_names);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "compensate");
+        if(!lua_isnil(L, -1)){
+            compensate = (bool)lua_toboolean(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "lines");
+        if(!lua_isnil(L, -1)){
+            lines = (bool)lua_toboolean(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+
+    if(pc->stacks.runningnb > 0 && mode != pc->mode){
+        return luaL_error(L, "can not change mode while profiling");
+    }
+
+    if(pc->timer.active && (hz != pc->timer.hz || clock != pc->timer.clock)){
+        return luaL_error(L, "can not change timer while it is running");
+    }
+
+    pc->mode = mode;
+    pc->sample_every = every;
+    pc->timer.hz = hz;
+    pc->timer.clock = clock;
+    pc->compensate = compensate;
+    pc->line.sample = lines;
+
+    pc->line.id = -1;
+
+    __profilecontext_anchor(L, true);
+
+    if(pc->mode == LP_MODE_TIMER){
+        if(!__timer_start(&pc->timer)){
+            __profilecontext_anchor(L, false);
+            return luaL_error(L, "can not start profile timer");
+        }
+
+        if(!__timer_addthread(&pc->timer, L)){
+            if(pc->timer.threadnb <= 0){
+                __timer_stop(&pc->timer);
+            }
+            __profilecontext_anchor(L, false);
+            return luaL_error(L, "too many threads for profile timer");
+        }
+    }else{
+        __timer_removethread(&pc->timer, L);
+        if(pc->timer.threadnb <= 0){
+            __timer_stop(&pc->timer);
+        }
+    }
+
+    __clock_calibrate(&pc->clock);
+
+    if(pc->compensate && !pc->overhead.calibrated){
+        __overhead_calibrate(L, pc);
+    }
+
+    __profilecontext_sethook(L, pc);
+
+    cs = __callstackpool_acquire(L, &pc->stacks, L);
+    if(!cs){
+        return luaL_error(L, "can not allocate call stack");
+    }
+
+    cs->nb = 0;
+    if(!cs->running){
+        cs->running = true;
+        ++pc->stacks.runningnb;
+    }
+
+    return 0;
+}
+
+static int pend(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    CallStack *cs = __callstackpool_get(L, &pc->stacks, L);
+
+    if(cs && cs->running){
+        cs->running = false;
+        --pc->stacks.runningnb;
+    }
+
+    lua_sethook(L, NULL, 0, 0);
+
+    __timer_removethread(&pc->timer, L);
+    if(pc->timer.threadnb <= 0){
+        __timer_stop(&pc->timer);
+    }
+
+    __callstackpool_release(L, &pc->stacks, L);
+    __profilecontext_anchor(L, false);
+
+    return 0;
+}
+
+typedef struct ReclaimArg {
+    ProfileContext *pc;
+    bool mark;
+} ReclaimArg;
+
+/* 这里不能抛错，否则一部分栈改了id一部分没改；__cct_enter建不出节点时落到[truncated] */
+static void __profilecontext_reclaimcb(void *ud, uint64_t key, void *val){
+    ReclaimArg *arg = ud;
+    ProfileContext *pc = arg->pc;
+    int *remap = pc->records.dirty;
+    CallStack *cs = val;
+
+    for(int i = 0; i < cs->nb; ++i){
+        CallFrame *cf = &cs->stk[i];
+
+        if(arg->mark){
+            if(cf->id >= 0){
+                remap[cf->id] = 0;
+            }
+            continue;
+        }
+
+        if(cf->id >= 0){
+            cf->id = remap[cf->id];
+        }
+
+        if(pc->cct.enabled){
+            int parent = i > 0 ? cs->stk[i - 1].node : LP_CCT_ROOT;
+            cf->node = cf->filtered ? parent : __cct_enter(&pc->cct, parent, cf->id);
+        }
+    }
+}
+
+static inline void __profilecontext_clear(lua_State *L, ProfileContext *pc){
+    RecordPool *rp = &pc->records;
+    ReclaimArg arg = {pc, true};
+
+    for(int i = 0; i < rp->nb; ++i){
+        rp->dirty[i] = -1;
+    }
+    if(pc->line.id >= 0){
+        rp->dirty[pc->line.id] = 0;
+    }
+    imap_foreach(&pc->stacks.usedmap, __profilecontext_reclaimcb, &arg);
+
+    __recordpool_clear(L, rp);
+    __edgepool_clear(L, &pc->edges);
+    __cct_reset(L, &pc->cct);
+
+    arg.mark = false;
+    imap_foreach(&pc->stacks.usedmap, __profilecontext_reclaimcb, &arg);
+    if(pc->line.id >= 0){
+        pc->line.id = rp->dirty[pc->line.id];
+    }
+    pc->line.lastkey = NULL;
+    pc->line.lastid = -1;
+
+    pc->stat_lossnspan = 0;
+    pc->stat_realnspan = 0;
+    pc->stat_yieldnspan = 0;
+    pc->stat_eventnb = 0;
+    pc->stat_samplenb = 0;
+    __overhead_clearhist(&pc->overhead);
+}
+
+static int pclear(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    __profilecontext_clear(L, pc);
+    return 0;
+}
+
+static void __dump_pushrecord(lua_State *L, ProfileContext *pc, int id){
+    ProtoRecord *pr = &pc->records.pool[id];
+    RecordHot *rh = &pc->records.hot[id];
+
+    lua_createtable(L, 0, 14);
+
+    lua_pushinteger(L, (uint64_t)pr->proto);
+    lua_setfield(L, -2, "proto");
+    lua_pushstring(L, pr->source);
+    lua_setfield(L, -2, "source");
+    lua_pushstring(L, pr->name);
+    lua_setfield(L, -2, "name");
+    lua_pushstring(L, pr->namewhat);
+    lua_setfield(L, -2, "namewhat");
+    lua_pushstring(L, pr->what);
+    lua_setfield(L, -2, "what");
+    lua_pushinteger(L, pr->line);
+    lua_setfield(L, -2, "line");
+    lua_pushinteger(L, rh->callnb);
+    lua_setfield(L, -2, "callnb");
+    lua_pushinteger(L, __clock_tons(&pc->clock, rh->total_nspan));
+    lua_setfield(L, -2, "total_nspan");
+    lua_pushinteger(L, __clock_tons(&pc->clock, rh->real_nspan));
+    lua_setfield(L, -2, "real_nspan");
+    lua_pushboolean(L, rh->istailcall);
+    lua_setfield(L, -2, "istailcall");
+    lua_pushinteger(L, __clock_tons(&pc->clock, rh->coroutine_nspan));
+    lua_setfield(L, -2, "coroutine_nspan");
+    lua_pushinteger(L, pr->samplenb);
+    lua_setfield(L, -2, "samplenb");
+    lua_pushinteger(L, pr->self_samplenb);
+    lua_setfield(L, -2, "self_samplenb");
+
+    if(rh->hist && rh->hist->nb > 0){
+        LatencyHist *hist = rh->hist;
+
+        lua_newtable(L);
+        lua_pushinteger(L, hist->nb);
+        lua_setfield(L, -2, "nb");
+        lua_pushinteger(L, __clock_tons(&pc->clock, hist->min));
+        lua_setfield(L, -2, "min");
+        lua_pushinteger(L, __clock_tons(&pc->clock, hist->max));
+        lua_setfield(L, -2, "max");
+        lua_pushinteger(L, __clock_tons(&pc->clock, __hist_quantile(hist, 0.5)));
+        lua_setfield(L, -2, "p50");
+        lua_pushinteger(L, __clock_tons(&pc->clock, __hist_quantile(hist, 0.9)));
+        lua_setfield(L, -2, "p90");
+        lua_pushinteger(L, __clock_tons(&pc->clock, __hist_quantile(hist, 0.99)));
+        lua_setfield(L, -2, "p99");
+        lua_pushinteger(L, __clock_tons(&pc->clock, __hist_quantile(hist, 0.999)));
+        lua_setfield(L, -2, "p999");
+        lua_setfield(L, -2, "latency");
+    }
+}
+
+static void dump_one_cb(void *ud, uint64_t key, void *val){
+    lua_State *L = ((DumpArg *)ud)->L;
+    ProfileContext *pc = ((DumpArg *)ud)->pc;
+
+    if(!__recordpool_hasdata(&pc->records, (int)(uint64_t)val)){
+        return;
+    }
 
-        lua_pop(L, 1);
-        pc = af(ud, NULL, 0, sizeof(pc[0]));
-        __profilecontext_init(L, pc);
-        p = lua_newuserdata(L, sizeof(p[0]));
-        *p = pc;
-        if(luaL_newmetatable(L, LPROFILE_METATBL_NAME)){
-            lua_pushcfunction(L, __profilecontext_gc);
-            lua_setfield(L, -2, "__gc");
-        }
+    lua_pushinteger(L, (uint64_t)pc->records.pool[(uint64_t)val].proto);
+    __dump_pushrecord(L, pc, (int)(uint64_t)val);
+    lua_settable(L, -3);
+}
 
-        lua_setmetatable(L, -2);
-        lua_pushvalue(L, -1);
-        lua_setfield(L, LUA_REGISTRYINDEX, LPROFILE_REGKEY_NAME);
+static int pdump(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    
+    DumpArg ud;
+
+    ud.L = L;
+    ud.pc = pc;
+
+    __clock_calibrate(&pc->clock);
+
+    lua_newtable(L);
+    imap_foreach(&pc->records.usedmap, dump_one_cb, &ud);
+
+    return 1;
+}
+
+typedef struct TopEntry {
+    uint64_t value;
+    int id;
+} TopEntry;
+
+static bool __top_value(RecordPool *rp, int id, int metric, uint64_t *out){
+    RecordHot *rh = &rp->hot[id];
+    ProtoRecord *pr = &rp->pool[id];
+    LatencyHist *hist = rh->hist && rh->hist->nb > 0 ? rh->hist : NULL;
+
+    switch(metric){
+        case LP_TOP_TOTAL:
+            *out = rh->total_nspan;
+            return rh->callnb > 0;
+        case LP_TOP_SELF:
+            *out = rh->real_nspan;
+            return rh->callnb > 0;
+        case LP_TOP_COROUTINE:
+            *out = rh->coroutine_nspan;
+            return rh->callnb > 0;
+        case LP_TOP_CALLS:
+            *out = rh->callnb;
+            return rh->callnb > 0;
+        case LP_TOP_MEAN:
+            *out = rh->callnb > 0 ? rh->total_nspan / rh->callnb : 0;
+            return rh->callnb > 0;
+        case LP_TOP_SAMPLES:
+            *out = pr->samplenb;
+            return pr->samplenb > 0;
+        case LP_TOP_SELFSAMPLES:
+            *out = pr->self_samplenb;
+            return pr->self_samplenb > 0;
+        case LP_TOP_P50:
+            *out = hist ? __hist_quantile(hist, 0.5) : 0;
+            return hist != NULL;
+        case LP_TOP_P90:
+            *out = hist ? __hist_quantile(hist, 0.9) : 0;
+            return hist != NULL;
+        case LP_TOP_P99:
+            *out = hist ? __hist_quantile(hist, 0.99) : 0;
+            return hist != NULL;
+        case LP_TOP_P999:
+            *out = hist ? __hist_quantile(hist, 0.999) : 0;
+            return hist != NULL;
+        default:
+            *out = hist ? hist->max : 0;
+            return hist != NULL;
     }
+}
 
-    pc = *(ProfileContext **)lua_touserdata(L, -1);
-    lua_pop(L, 1);
-    return pc;
+static inline bool __top_less(const TopEntry *a, const TopEntry *b){
+    return a->value < b->value || (a->value == b->value && a->id > b->id);
 }
 
-static inline uint64_t gethpc(){
-    struct timespec ti;
-    clock_gettime(CLOCK_REALTIME, &ti);
-    return (uint64_t)1000000000 * ti.tv_sec + (uint64_t)ti.tv_nsec;
+static void __top_siftup(TopEntry *heap, int i){
+    while(i > 0){
+        int parent = (i - 1) / 2;
+        TopEntry tmp;
+
+        if(!__top_less(&heap[i], &heap[parent])){
+            break;
+        }
+
+        tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
 }
 
-/* tailcall直接覆盖用的hook */
-static void lua_hook_cb(lua_State *L, lua_Debug *ar){
-    uint64_t event_hpc = gethpc();
-    int event = ar->event;
-    lua_Debug dbg;
-    int ret;
-    void *proto;
-    const char *source;
-    const char *name;
-    const char *namewhat;
-    const char *what;
-    int line;
-    ProfileContext *pc = __profilecontext_get(L);
-    void *co;
-    void *val;
-    CallStack *cs;
+static void __top_siftdown(TopEntry *heap, int nb, int i){
+    for(;;){
+        int left = 2 * i + 1;
+        int right = left + 1;
+        int min = i;
+        TopEntry tmp;
 
-    if(!pc || !pc->enabled){
-        return;
+        if(left < nb && __top_less(&heap[left], &heap[min])){
+            min = left;
+        }
+        if(right < nb && __top_less(&heap[right], &heap[min])){
+            min = right;
+        }
+        if(min == i){
+            break;
+        }
+
+        tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
     }
+}
 
-    lua_pushthread(L);
-    co = (void *)lua_topointer(L, -1);
-    lua_pop(L, 1);
+/* ptop(n[, metric])返回指标最大的n条记录，从大到小 */
+static int ptop(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    lua_Integer n = luaL_checkinteger(L, 1);
+    int metric = luaL_checkoption(L, 2, "self", lp_top_names);
+    bool istime = metric != LP_TOP_CALLS && metric != LP_TOP_SAMPLES && metric != LP_TOP_SELFSAMPLES;
+    TopEntry *heap;
+    int heapnb = 0;
 
-    cs = __callstackpool_get(L, &pc->stacks, co);
-    if(!cs){
-        return;
+    luaL_argcheck(L, n > 0, 1, "n must be positive");
+    n = n < rp->nb ? n : rp->nb;
+
+    __clock_calibrate(&pc->clock);
+
+    heap = lua_newuserdata(L, (size_t)n * sizeof(heap[0]));
+
+    for(int id = 0; id < rp->nb; ++id){
+        TopEntry e;
+
+        if(!__top_value(rp, id, metric, &e.value)){
+            continue;
+        }
+        e.id = id;
+
+        if(heapnb < n){
+            heap[heapnb] = e;
+            __top_siftup(heap, heapnb++);
+        }else if(__top_less(&heap[0], &e)){
+            heap[0] = e;
+            __top_siftdown(heap, heapnb, 0);
+        }
     }
 
-    if(!imap_get(&pc->runnings, (uint64_t)co, &val)){
-        return;
+    for(int k = heapnb - 1; k > 0; --k){
+        TopEntry tmp = heap[0];
+
+        heap[0] = heap[k];
+        heap[k] = tmp;
+        __top_siftdown(heap, k, 0);
     }
 
-    ret = lua_getstack(L, 0, &dbg);
-    if(!ret){
-        return;
+    lua_createtable(L, heapnb, 0);
+    for(int i = 0; i < heapnb; ++i){
+        __dump_pushrecord(L, pc, heap[i].id);
+        lua_pushinteger(L, istime ? __clock_tons(&pc->clock, heap[i].value) : heap[i].value);
+        lua_setfield(L, -2, "value");
+        lua_rawseti(L, -2, i + 1);
     }
 
-    ret = lua_getinfo(L, "nSlf", &dbg);
-    if(!ret){
-        return;
+    return 1;
+}
+
+/* 游标只记下一个要看的记录id，pclear和psetaggregate之后作废 */
+typedef struct LpCursor {
+    uint64_t generation;
+    int next;
+} LpCursor;
+
+/* cur:next(batch)返回下一批最多batch条，翻完返回nil；期间调过pclear或psetaggregate时报错 */
+static int pcursor_next(lua_State *L){
+    LpCursor *cur = luaL_checkudata(L, 1, LPROFILE_CURSOR_NAME);
+    lua_Integer batch = luaL_optinteger(L, 2, 1000);
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    int n = 0;
+
+    luaL_argcheck(L, batch > 0, 2, "batch must be positive");
+
+    if(cur->generation != rp->generation){
+        return luaL_error(L, "records were reset, cursor is no longer valid");
     }
 
-    proto = (void *)lua_topointer(L, -1);
-    source = dbg.source;
-    name = dbg.name;
-    namewhat = dbg.namewhat;
-    what = dbg.what;
-    line = dbg.linedefined;
+    while(cur->next < rp->nb && !__recordpool_hasdata(rp, cur->next)){
+        ++cur->next;
+    }
 
-    lplog("lua_hook_cb proto=%p,event=%d,name=%s,source=%s\n", proto, event, name ? name : "", source ? source : "");
+    if(cur->next >= rp->nb){
+        lua_pushnil(L);
+        return 1;
+    }
 
-    if(event == LUA_HOOKCALL){
-        uint64_t hpc;
-        CallFrame *cf = __callstack_push(L, cs);
-        cf->proto = proto;
-        cf->source = source;
-        cf->name = name;
-        cf->namewhat = namewhat;
-        cf->what = what;
-        cf->line = line;
-        cf->call_evt_hpc = event_hpc;
-        cf->ret_hpc = 0;
-        cf->istailcall = 0;
-        cf->total_nspan = 0;
-        cf->real_nspan = 0;
-        cf->sub_nspan = 0;
-        cf->yield_nspan = 0;
+    __clock_calibrate(&pc->clock);
 
-        hpc = gethpc();
-        cf->call_real_hpc = hpc;
-        pc->stat_lossnspan += hpc - event_hpc;
-    }else if(event == LUA_HOOKTAILCALL){
-        CallFrame *cf = __callstack_top(L, cs);
-        if(cf){
-            cf->proto = proto;
-            cf->source = source;
-            cf->name = name;
-            cf->namewhat = namewhat;
-            cf->what = what;
-            cf->line = line;
-            cf->istailcall = 1;
+    lua_createtable(L, batch < 256 ? (int)batch : 256, 0);
+    for(; cur->next < rp->nb && n < batch; ++cur->next){
+        if(!__recordpool_hasdata(rp, cur->next)){
+            continue;
         }
 
-        pc->stat_lossnspan += gethpc() - event_hpc;
-    }else if(event == LUA_HOOKRET){
-        uint64_t hpc;
-        CallFrame *cf;
-        CallFrame *precf;
+        __dump_pushrecord(L, pc, cur->next);
+        lua_rawseti(L, -2, ++n);
+    }
 
-        while((cf = __callstack_pop(L, cs)) != NULL && cf->proto != proto){
-            lplog("lua_hook_cb proto not match this=%p,recorded=%p\n", proto, cf->proto);
-        }
+    return 1;
+}
 
-        if(!cf){
-            lplog("lua_hook_cb proto no call frame this=%p\n", proto);
-            return;
-        }
+static int pcursor(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    LpCursor *cur = lua_newuserdata(L, sizeof(cur[0]));
 
-        cf->ret_hpc = event_hpc;
-        cf->total_nspan = event_hpc - cf->call_real_hpc;
-        cf->real_nspan = cf->total_nspan - cf->sub_nspan;
+    cur->generation = pc->records.generation;
+    cur->next = 0;
 
-        if(proto == pc->proto_yield){
-            cf->yield_nspan += cf->real_nspan;
-            pc->stat_yieldnspan += cf->real_nspan;
-        }
+    if(luaL_newmetatable(L, LPROFILE_CURSOR_NAME)){
+        lua_newtable(L);
+        lua_pushcfunction(L, pcursor_next);
+        lua_setfield(L, -2, "next");
+        lua_setfield(L, -2, "__index");
+    }
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
 
-        __recordpool_record(L, &pc->records, cf);
+static int pdumpgraph(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    EdgePool *ep = &pc->edges;
 
-        precf = __callstack_top(L, cs);
-        hpc = gethpc();
-        if(precf){
-            precf->sub_nspan += hpc - cf->call_evt_hpc;
-            precf->yield_nspan += cf->yield_nspan;
+    __clock_calibrate(&pc->clock);
+
+    lua_createtable(L, ep->nb, 0);
+    for(int i = 0, n = 0; i < ep->nb; ++i){
+        EdgeRecord *er = &ep->pool[i];
+
+        if(er->callnb == 0){
+            continue;
         }
 
-        pc->stat_realnspan += cf->real_nspan;
-        pc->stat_lossnspan += hpc - event_hpc;
+        lua_createtable(L, 0, 5);
+        lua_pushinteger(L, (uint64_t)rp->pool[er->caller].proto);
+        lua_setfield(L, -2, "caller");
+        lua_pushinteger(L, (uint64_t)rp->pool[er->callee].proto);
+        lua_setfield(L, -2, "callee");
+        lua_pushinteger(L, er->callnb);
+        lua_setfield(L, -2, "callnb");
+        lua_pushinteger(L, __clock_tons(&pc->clock, er->total_nspan));
+        lua_setfield(L, -2, "total_nspan");
+        lua_pushinteger(L, __clock_tons(&pc->clock, er->real_nspan));
+        lua_setfield(L, -2, "real_nspan");
+        lua_rawseti(L, -2, ++n);
     }
+
+    return 1;
 }
 
-/* 追踪tailcall用的hook */
-static void lua_hook_cb_tracetailcall(lua_State *L, lua_Debug *ar){
-    uint64_t event_hpc = gethpc();
-    int event = ar->event;
-    lua_Debug dbg;
-    int ret;
-    void *proto;
-    const char *source;
-    const char *name;
-    const char *namewhat;
-    const char *what;
-    int line;
-    ProfileContext *pc = __profilecontext_get(L);
-    void *co;
-    void *val;
-    CallStack *cs;
+static void dump_lines_cb(void *ud, uint64_t key, void *val){
+    lua_State *L = ((DumpArg *)ud)->L;
+    ProfileContext *pc = ((DumpArg *)ud)->pc;
+    ProtoRecord *pr = &pc->records.pool[(uint64_t)val];
+    bool any = false;
 
-    if(!pc || !pc->enabled){
+    if(!pr->lines){
         return;
     }
 
-    lua_pushthread(L);
-    co = (void *)lua_topointer(L, -1);
-    lua_pop(L, 1);
+    lua_newtable(L);
+    for(int i = 0; i < pr->linenb; ++i){
+        LineStat *ls = &pr->lines[i];
 
-    cs = __callstackpool_get(L, &pc->stacks, co);
-    if(!cs){
-        return;
+        if(ls->hitnb == 0 && ls->samplenb == 0){
+            continue;
+        }
+
+        lua_newtable(L);
+        lua_pushinteger(L, __clock_tons(&pc->clock, ls->nspan));
+        lua_setfield(L, -2, "nspan");
+        lua_pushinteger(L, ls->hitnb);
+        lua_setfield(L, -2, "hitnb");
+        lua_pushinteger(L, ls->samplenb);
+        lua_setfield(L, -2, "samplenb");
+        lua_rawseti(L, -2, pr->line + i);
+        any = true;
     }
 
-    if(!imap_get(&pc->runnings, (uint64_t)co, &val)){
+    if(!any){
+        lua_pop(L, 1);
         return;
     }
 
-    ret = lua_getstack(L, 0, &dbg);
-    if(!ret){
-        return;
+    lua_pushinteger(L, (uint64_t)pr->proto);
+    lua_newtable(L);
+    lua_pushstring(L, pr->source);
+    lua_setfield(L, -2, "source");
+    lua_pushstring(L, pr->name);
+    lua_setfield(L, -2, "name");
+    lua_pushinteger(L, pr->line);
+    lua_setfield(L, -2, "line");
+    lua_pushinteger(L, pr->lastline);
+    lua_setfield(L, -2, "lastline");
+    lua_pushvalue(L, -3);
+    lua_setfield(L, -2, "lines");
+    lua_settable(L, -4);
+    lua_pop(L, 1);
+}
+
+static int pdumplines(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    DumpArg ud;
+
+    ud.L = L;
+    ud.pc = pc;
+
+    __clock_calibrate(&pc->clock);
+
+    lua_newtable(L);
+    imap_foreach(&pc->records.usedmap, dump_lines_cb, &ud);
+
+    return 1;
+}
+
+#define LP_WRITEBUF_SIZE 16384
+
+typedef struct LpWriter {
+    int fd;
+    bool owned;
+    bool failed;
+    int err;
+    char *mem;
+    size_t nb;
+    char buf[LP_WRITEBUF_SIZE];
+} LpWriter;
+
+static void __writer_flush(LpWriter *w){
+    size_t off = 0;
+
+    while(!w->failed && off < w->nb){
+        ssize_t n = write(w->fd, w->buf + off, w->nb - off);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            w->failed = true;
+            w->err = errno;
+            break;
+        }
+        off += (size_t)n;
     }
 
-    ret = lua_getinfo(L, "nSlf", &dbg);
-    if(!ret){
+    w->nb = 0;
+}
+
+static inline void __writer_put(LpWriter *w, const void *data, size_t len){
+    const char *p = data;
+
+    if(w->mem){
+        memcpy(w->mem + w->nb, data, len);
+        w->nb += len;
         return;
     }
 
-    proto = (void *)lua_topointer(L, -1);
-    source = dbg.source;
-    name = dbg.name;
-    namewhat = dbg.namewhat;
-    what = dbg.what;
-    line = dbg.linedefined;
+    while(len > 0){
+        size_t n;
 
-    lplog("lua_hook_cb proto=%p,event=%d,name=%s,source=%s\n", proto, event, name ? name : "", source ? source : "");
+        if(w->nb >= sizeof(w->buf)){
+            __writer_flush(w);
+        }
 
-    if(event == LUA_HOOKCALL){
-        uint64_t hpc;
-        CallFrame *cf = __callstack_push(L, cs);
-        cf->proto = proto;
-        cf->source = source;
-        cf->name = name;
-        cf->namewhat = namewhat;
-        cf->what = what;
-        cf->line = line;
-        cf->call_evt_hpc = event_hpc;
-        cf->ret_hpc = 0;
-        cf->istailcall = 0;
-        cf->total_nspan = 0;
-        cf->real_nspan = 0;
-        cf->sub_nspan = 0;
-        cf->yield_nspan = 0;
+        n = sizeof(w->buf) - w->nb;
+        n = n < len ? n : len;
+        memcpy(w->buf + w->nb, p, n);
+        w->nb += n;
+        p += n;
+        len -= n;
+    }
+}
 
-        hpc = gethpc();
-        cf->call_real_hpc = hpc;
-        pc->stat_lossnspan += hpc - event_hpc;
-    }else if(event == LUA_HOOKTAILCALL){
-        uint64_t hpc;
-        CallFrame *cf = __callstack_push(L, cs);
-        cf->proto = proto;
-        cf->source = source;
-        cf->name = name;
-        cf->namewhat = namewhat;
-        cf->what = what;
-        cf->line = line;
-        cf->call_evt_hpc = event_hpc;
-        cf->ret_hpc = 0;
-        cf->istailcall = 1;
-        cf->total_nspan = 0;
-        cf->real_nspan = 0;
-        cf->sub_nspan = 0;
-        cf->yield_nspan = 0;
+static void __writer_open(lua_State *L, LpWriter *w, int idx){
+    w->nb = 0;
+    w->failed = false;
+    w->err = 0;
+    w->mem = NULL;
 
-        hpc = gethpc();
-        cf->call_real_hpc = hpc;
-        pc->stat_lossnspan += hpc - event_hpc;
-    }else if(event == LUA_HOOKRET){
-        uint64_t hpc;
-        CallFrame *cf;
-        CallFrame *precf;
+    if(lua_type(L, idx) == LUA_TNUMBER){
+        w->fd = (int)luaL_checkinteger(L, idx);
+        w->owned = false;
+    }else{
+        const char *path = luaL_checkstring(L, idx);
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        w->owned = true;
+        if(w->fd < 0){
+            luaL_error(L, "can not open %s: %s", path, strerror(errno));
+        }
+    }
+}
 
-        /* 无论是不是tailcall，ret必须匹配得上callstack的栈顶，否则丢弃 */
-        while((cf = __callstack_pop(L, cs)) != NULL && cf->proto != proto){
-            lplog("lua_hook_cb proto not match this=%p,recorded=%p\n", proto, cf->proto);
+static void __writer_close(lua_State *L, LpWriter *w){
+    __writer_flush(w);
+
+    if(w->owned && close(w->fd) < 0 && !w->failed){
+        w->failed = true;
+        w->err = errno;
+    }
+
+    if(w->failed){
+        luaL_error(L, "write failed: %s", strerror(w->err));
+    }
+}
+
+static size_t __folded_label(RecordPool *rp, int record, char *out, size_t cap){
+    ProtoRecord *pr = &rp->pool[record];
+    const char *source = pr->source;
+    int n;
+
+    if(*source == '@' || *source == '='){
+        ++source;
+    }
+
+    if(*pr->name){
+        n = snprintf(out, cap, "%s (%s:%d)", pr->name, source, pr->line);
+    }else{
+        n = snprintf(out, cap, "%s:%d", source, pr->line);
+    }
+
+    n = n < 0 ? 0 : ((size_t)n >= cap ? (int)cap - 1 : n);
+    for(int i = 0; i < n; ++i){
+        if(out[i] == ';'){
+            out[i] = ',';
+        }else if(out[i] == '\n' || out[i] == '\r'){
+            out[i] = ' ';
         }
+    }
 
-        if(!cf){
-            lplog("lua_hook_cb proto no call frame this=%p\n", proto);
-            return;
+    return (size_t)n;
+}
+
+/* pdumpfolded(path_or_fd[, "time"|"calls"])按cct输出flamegraph.pl的collapsed格式 */
+static int pdumpfolded(lua_State *L){
+    static const char *const metrics[] = {"time", "calls", NULL};
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    CctContext *cc = &pc->cct;
+    MemAccount *mem = &pc->mem.accounts[LP_MEM_CCT];
+    int metric = luaL_checkoption(L, 2, "time", metrics);
+    LpWriter w;
+    size_t *lens;
+    size_t lensnb;
+    char *path = NULL;
+    size_t pathcap = 0;
+    size_t pathnb = 0;
+    lua_Integer linenb = 0;
+    int node;
+
+    if(cc->nb <= LP_CCT_TRUNCATED){
+        return luaL_error(L, "cct is not enabled");
+    }
+
+    __clock_calibrate(&pc->clock);
+
+    lensnb = 0;
+    for(int i = 0; i < cc->nb; ++i){
+        lensnb = (size_t)cc->nodes[i].depth + 1 > lensnb ? (size_t)cc->nodes[i].depth + 1 : lensnb;
+    }
+
+    __writer_open(L, &w, 1);
+
+    lens = __mem_alloc(mem, NULL, 0, lensnb * sizeof(lens[0]));
+    if(!lens){
+        w.failed = true;
+        w.err = ENOMEM;
+        __writer_close(L, &w);
+    }
+
+    node = cc->nodes[LP_CCT_ROOT].first_child;
+    while(node >= 0){
+        CctNode *cn = &cc->nodes[node];
+        char label[512];
+        size_t labelnb;
+        uint64_t value;
+
+        pathnb = cn->depth > 1 ? lens[cn->depth - 1] : 0;
+        if(node == LP_CCT_TRUNCATED || cn->record < 0){
+            labelnb = (size_t)snprintf(label, sizeof(label), "[truncated]");
+        }else{
+            labelnb = __folded_label(rp, cn->record, label, sizeof(label));
         }
 
-        do {
-            cf->ret_hpc = event_hpc;
-            cf->total_nspan = cf->ret_hpc - cf->call_real_hpc;
-            cf->real_nspan = cf->total_nspan - cf->sub_nspan;
+        if(pathnb + labelnb + 1 > pathcap){
+            size_t newcap = pathcap ? pathcap : 1024;
+            char *newpath;
 
-            if(proto == pc->proto_yield){
-                cf->yield_nspan += cf->real_nspan;
-                pc->stat_yieldnspan += cf->real_nspan;
+            while(pathnb + labelnb + 1 > newcap){
+                newcap *= 2;
             }
 
-            __recordpool_record(L, &pc->records, cf);
-
-            precf = __callstack_top(L, cs);
-            hpc = gethpc();
-            if(precf){
-                precf->sub_nspan += hpc - cf->call_evt_hpc;
-                precf->yield_nspan += cf->yield_nspan;
+            newpath = __mem_alloc(mem, path, pathcap, newcap);
+            if(!newpath){
+                w.failed = true;
+                w.err = ENOMEM;
+                break;
             }
+            path = newpath;
+            pathcap = newcap;
+        }
+
+        if(pathnb > 0){
+            path[pathnb++] = ';';
+        }
+        memcpy(path + pathnb, label, labelnb);
+        pathnb += labelnb;
+        lens[cn->depth] = pathnb;
+
+        value = metric == 0 ? __clock_tons(&pc->clock, cn->real_nspan) : cn->callnb;
+        if(value > 0){
+            char num[32];
+            int numnb = snprintf(num, sizeof(num), " %llu\n", (unsigned long long)value);
+
+            __writer_put(&w, path, pathnb);
+            __writer_put(&w, num, (size_t)numnb);
+            ++linenb;
+        }
+
+        if(cn->first_child >= 0){
+            node = cn->first_child;
+            continue;
+        }
 
-            pc->stat_realnspan += cf->real_nspan;
+        while(node >= 0 && cc->nodes[node].next_sibling < 0){
+            node = cc->nodes[node].parent;
+            node = node == LP_CCT_ROOT ? -1 : node;
+        }
 
-        }while(cf->istailcall && (cf = __callstack_pop(L, cs)) != NULL);
+        if(node >= 0){
+            node = cc->nodes[node].next_sibling;
+        }
+    }
 
-        pc->stat_lossnspan += gethpc() - event_hpc;
+    __mem_alloc(mem, lens, lensnb * sizeof(lens[0]), 0);
+    if(path){
+        __mem_alloc(mem, path, pathcap, 0);
     }
+
+    __writer_close(L, &w);
+
+    lua_pushinteger(L, linenb);
+    return 1;
 }
 
+static inline void __recordpool_current(RecordPool *rp, int id, RecordBase *out){
+    RecordHot *rh = &rp->hot[id];
+    ProtoRecord *pr = &rp->pool[id];
 
-static int pbegin(lua_State *L){
+    out->callnb = rh->callnb;
+    out->total_nspan = rh->total_nspan;
+    out->real_nspan = rh->real_nspan;
+    out->coroutine_nspan = rh->coroutine_nspan;
+    out->samplenb = pr->samplenb;
+    out->self_samplenb = pr->self_samplenb;
+}
+
+/* pdumpdelta()只返回上次pdumpdelta之后计数变过的记录，计数是这段时间里的增量 */
+static int pdumpdelta(lua_State *L){
     ProfileContext *pc = __profilecontext_getorcreate(L);
-    void *co;
-    CallStack *cs;
+    RecordPool *rp = &pc->records;
+    int n = 0;
 
-    lua_pushthread(L);
-    co = (void *)lua_topointer(L, -1);
-    lua_pop(L, 1);
+    __clock_calibrate(&pc->clock);
+
+    lua_newtable(L);
+
+    /* 建表可能触发GC，finalizer会往脏列表后面追加，每轮重新取长度和指针 */
+    for(int i = 0; i < rp->dirtynb; ++i){
+        int id = rp->dirty[i];
+        ProtoRecord *pr = &rp->pool[id];
+        RecordBase cur;
+        RecordBase delta;
+        uint64_t key = (uint64_t)pr->proto;
+        const char *source = pr->source;
+        const char *name = pr->name;
+        int line = pr->line;
+
+        __recordpool_current(rp, id, &cur);
+        delta.callnb = cur.callnb - pr->base.callnb;
+        delta.total_nspan = cur.total_nspan - pr->base.total_nspan;
+        delta.real_nspan = cur.real_nspan - pr->base.real_nspan;
+        delta.coroutine_nspan = cur.coroutine_nspan - pr->base.coroutine_nspan;
+        delta.samplenb = cur.samplenb - pr->base.samplenb;
+        delta.self_samplenb = cur.self_samplenb - pr->base.self_samplenb;
+        pr->base = cur;
+
+        if(delta.callnb == 0 && delta.samplenb == 0){
+            continue;
+        }
 
-    imap_set(&pc->runnings, (uint64_t)co, (void *)1);
+        /* 下面建表期间pool可能扩容，pr不能再用 */
+        lua_pushinteger(L, key);
+        lua_createtable(L, 0, 9);
+        lua_pushstring(L, source);
+        lua_setfield(L, -2, "source");
+        lua_pushstring(L, name);
+        lua_setfield(L, -2, "name");
+        lua_pushinteger(L, line);
+        lua_setfield(L, -2, "line");
+        lua_pushinteger(L, delta.callnb);
+        lua_setfield(L, -2, "callnb");
+        lua_pushinteger(L, __clock_tons(&pc->clock, delta.total_nspan));
+        lua_setfield(L, -2, "total_nspan");
+        lua_pushinteger(L, __clock_tons(&pc->clock, delta.real_nspan));
+        lua_setfield(L, -2, "real_nspan");
+        lua_pushinteger(L, __clock_tons(&pc->clock, delta.coroutine_nspan));
+        lua_setfield(L, -2, "coroutine_nspan");
+        lua_pushinteger(L, delta.samplenb);
+        lua_setfield(L, -2, "samplenb");
+        lua_pushinteger(L, delta.self_samplenb);
+        lua_setfield(L, -2, "self_samplenb");
+        lua_settable(L, -3);
+    }
+
+    for(int i = 0; i < rp->dirtynb; ++i){
+        int id = rp->dirty[i];
+
+        if((uint64_t)rp->hot[id].callnb != rp->pool[id].base.callnb || rp->pool[id].samplenb != rp->pool[id].base.samplenb){
+            rp->dirty[n++] = id;
+        }else{
+            rp->hot[id].dirty = 0;
+        }
+    }
+    rp->dirtynb = n;
+
+    return 1;
+}
 
-    if(pc->trace_tailcall){
-        lua_sethook(L, lua_hook_cb_tracetailcall, LUA_MASKCALL | LUA_MASKRET, 0);
-    }else{
-        lua_sethook(L, lua_hook_cb, LUA_MASKCALL | LUA_MASKRET, 0);
-    }
+typedef struct DumpBinArg {
+    LpWriter *w;
+    uint32_t strnb;
+    uint32_t strbytes;
+    uint32_t rownb;
+} DumpBinArg;
 
-    cs = __callstackpool_acquire(L, &pc->stacks, co);
-    cs->nb = 0;
+static void __dumpbin_tagcb(void *ud, IstrNode *node){
+    DumpBinArg *arg = ud;
 
-    return 0;
+    node->tag = arg->strnb++;
+    arg->strbytes += 4 + (uint32_t)node->len;
 }
 
-static int pend(lua_State *L){
-    ProfileContext *pc = __profilecontext_getorcreate(L);
-    void *co;
+static void __dumpbin_strcb(void *ud, IstrNode *node){
+    DumpBinArg *arg = ud;
+    unsigned char len[4];
 
-    lua_pushthread(L);
-    co = (void *)lua_topointer(L, -1);
-    lua_pop(L, 1);
+    lpbin_putu32(len, (uint32_t)node->len);
+    __writer_put(arg->w, len, sizeof(len));
+    __writer_put(arg->w, node->str, node->len);
+}
 
-    imap_remove(&pc->runnings, (uint64_t)co);
-    lua_sethook(L, NULL, 0, 0);
+/* 到写完之前不能调Lua API，否则编号可能失效 */
+static size_t __dumpbin_prepare(RecordPool *rp, DumpBinArg *arg){
+    arg->strnb = 0;
+    arg->strbytes = 0;
+    arg->rownb = 0;
 
-    __callstackpool_release(L, &pc->stacks, co);
+    istr_foreach(&rp->strs, __dumpbin_tagcb, arg);
+    for(int id = 0; id < rp->nb; ++id){
+        arg->rownb += __recordpool_hasdata(rp, id);
+    }
 
-    return 0;
+    return LPBIN_HEADER_SIZE + arg->strbytes + (size_t)arg->rownb * LPBIN_ROW_SIZE;
 }
 
-static int pclear(lua_State *L){
-    ProfileContext *pc = __profilecontext_getorcreate(L);
-    __recordpool_clear(L, &pc->records);
-    pc->stat_lossnspan = 0;
-    pc->stat_realnspan = 0;
-    pc->stat_yieldnspan = 0;
-    return 0;
+static void __dumpbin_write(ProfileContext *pc, DumpBinArg *arg){
+    RecordPool *rp = &pc->records;
+    unsigned char hdr[LPBIN_HEADER_SIZE];
+    unsigned char row[LPBIN_ROW_SIZE];
+
+    memcpy(hdr + LPBIN_HDR_MAGIC, LPBIN_MAGIC, 4);
+    lpbin_putu32(hdr + LPBIN_HDR_VERSION, LPBIN_VERSION);
+    lpbin_putu32(hdr + LPBIN_HDR_HEADERSIZE, LPBIN_HEADER_SIZE);
+    lpbin_putu32(hdr + LPBIN_HDR_ROWSIZE, LPBIN_ROW_SIZE);
+    lpbin_putu32(hdr + LPBIN_HDR_STRNB, arg->strnb);
+    lpbin_putu32(hdr + LPBIN_HDR_STRBYTES, arg->strbytes);
+    lpbin_putu32(hdr + LPBIN_HDR_ROWNB, arg->rownb);
+    lpbin_putu32(hdr + LPBIN_HDR_FLAGS, 0);
+    __writer_put(arg->w, hdr, sizeof(hdr));
+
+    istr_foreach(&rp->strs, __dumpbin_strcb, arg);
+
+    for(int id = 0; id < rp->nb; ++id){
+        ProtoRecord *pr = &rp->pool[id];
+        RecordHot *rh = &rp->hot[id];
+        LatencyHist *hist = rh->hist && rh->hist->nb > 0 ? rh->hist : NULL;
+        uint32_t flags = 0;
+
+        if(!__recordpool_hasdata(rp, id)){
+            continue;
+        }
+
+        flags |= rh->istailcall ? LPBIN_ROW_TAILCALL : 0;
+        flags |= hist ? LPBIN_ROW_LATENCY : 0;
+
+        memset(row, 0, sizeof(row));
+        lpbin_putu64(row + LPBIN_ROW_KEY, (uint64_t)pr->proto);
+        lpbin_putu32(row + LPBIN_ROW_SOURCE, istr_node(pr->source)->tag);
+        lpbin_putu32(row + LPBIN_ROW_NAME, istr_node(pr->name)->tag);
+        lpbin_putu32(row + LPBIN_ROW_NAMEWHAT, istr_node(pr->namewhat)->tag);
+        lpbin_putu32(row + LPBIN_ROW_WHAT, istr_node(pr->what)->tag);
+        lpbin_putu32(row + LPBIN_ROW_LINE, (uint32_t)pr->line);
+        lpbin_putu32(row + LPBIN_ROW_FLAGS, flags);
+        lpbin_putu64(row + LPBIN_ROW_CALLNB, rh->callnb);
+        lpbin_putu64(row + LPBIN_ROW_TOTAL, __clock_tons(&pc->clock, rh->total_nspan));
+        lpbin_putu64(row + LPBIN_ROW_REAL, __clock_tons(&pc->clock, rh->real_nspan));
+        lpbin_putu64(row + LPBIN_ROW_COROUTINE, __clock_tons(&pc->clock, rh->coroutine_nspan));
+        lpbin_putu64(row + LPBIN_ROW_SAMPLENB, pr->samplenb);
+        lpbin_putu64(row + LPBIN_ROW_SELFSAMPLENB, pr->self_samplenb);
+        if(hist){
+            lpbin_putu64(row + LPBIN_ROW_LATENCYNB, hist->nb);
+            lpbin_putu64(row + LPBIN_ROW_LATENCYMIN, __clock_tons(&pc->clock, hist->min));
+            lpbin_putu64(row + LPBIN_ROW_LATENCYMAX, __clock_tons(&pc->clock, hist->max));
+            lpbin_putu64(row + LPBIN_ROW_P50, __clock_tons(&pc->clock, __hist_quantile(hist, 0.5)));
+            lpbin_putu64(row + LPBIN_ROW_P90, __clock_tons(&pc->clock, __hist_quantile(hist, 0.9)));
+            lpbin_putu64(row + LPBIN_ROW_P99, __clock_tons(&pc->clock, __hist_quantile(hist, 0.99)));
+            lpbin_putu64(row + LPBIN_ROW_P999, __clock_tons(&pc->clock, __hist_quantile(hist, 0.999)));
+        }
+        __writer_put(arg->w, row, sizeof(row));
+    }
 }
 
-static void dump_one_cb(void *ud, uint64_t key, void *val){
-    lua_State *L = ((DumpArg *)ud)->L;
-    ProfileContext *pc = ((DumpArg *)ud)->pc;
-    ProtoRecord *pr = &pc->records.pool[(uint64_t)val];
+/* pdumpbin([path_or_fd])按lpbin.h的格式导出，用lpdecode解 */
+static int pdumpbin(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    DumpBinArg arg;
+    LpWriter w;
+    luaL_Buffer b;
+    size_t size;
+    int top;
+
+    __clock_calibrate(&pc->clock);
+    arg.w = &w;
+
+    if(!lua_isnoneornil(L, 1)){
+        __writer_open(L, &w, 1);
+        size = __dumpbin_prepare(&pc->records, &arg);
+        __dumpbin_write(pc, &arg);
+        __writer_close(L, &w);
+        lua_pushinteger(L, (lua_Integer)size);
+        return 1;
+    }
 
-    lua_pushinteger(L, (uint64_t)pr->proto);
-    lua_newtable(L);
+    top = lua_gettop(L);
 
-    lua_pushinteger(L, (uint64_t)pr->proto);
-    lua_setfield(L, -2, "proto");
-    lua_pushstring(L, pr->source);
-    lua_setfield(L, -2, "source");
-    lua_pushstring(L, pr->name);
-    lua_setfield(L, -2, "name");
-    lua_pushstring(L, pr->namewhat);
-    lua_setfield(L, -2, "namewhat");
-    lua_pushstring(L, pr->what);
-    lua_setfield(L, -2, "what");
-    lua_pushinteger(L, pr->line);
-    lua_setfield(L, -2, "line");
-    lua_pushinteger(L, pr->callnb);
-    lua_setfield(L, -2, "callnb");
-    lua_pushinteger(L, pr->total_nspan);
-    lua_setfield(L, -2, "total_nspan");
-    lua_pushinteger(L, pr->real_nspan);
-    lua_setfield(L, -2, "real_nspan");
-    lua_pushboolean(L, pr->istailcall);
-    lua_setfield(L, -2, "istailcall");
-    lua_pushinteger(L, pr->coroutine_nspan);
-    lua_setfield(L, -2, "coroutine_nspan");
+    /* 分配字符串可能触发GC，finalizer里的调用会建新记录、驻留新串，重新编号后大小变了就重来 */
+    for(;;){
+        size = __dumpbin_prepare(&pc->records, &arg);
+        w.mem = luaL_buffinitsize(L, &b, size);
+        if(__dumpbin_prepare(&pc->records, &arg) == size){
+            break;
+        }
+        lua_settop(L, top);
+    }
 
-    lua_settable(L, -3);
+    w.nb = 0;
+    __dumpbin_write(pc, &arg);
+    luaL_pushresultsize(&b, size);
+    return 1;
 }
 
-static int pdump(lua_State *L){
+static int pdumpcct(lua_State *L){
     ProfileContext *pc = __profilecontext_getorcreate(L);
-    
-    DumpArg ud;
-
-    ud.L = L;
-    ud.pc = pc;
-
-    lua_newtable(L);
-    imap_foreach(&pc->records.usedmap, dump_one_cb, &ud);
+    RecordPool *rp = &pc->records;
+    CctContext *cc = &pc->cct;
+
+    __clock_calibrate(&pc->clock);
+
+    lua_createtable(L, cc->nb, 0);
+    for(int i = 0; i < cc->nb; ++i){
+        CctNode *cn = &cc->nodes[i];
+
+        lua_createtable(L, 0, 7);
+        lua_pushinteger(L, cn->parent + 1);
+        lua_setfield(L, -2, "parent");
+        lua_pushinteger(L, cn->record >= 0 ? (uint64_t)rp->pool[cn->record].proto : 0);
+        lua_setfield(L, -2, "key");
+        lua_pushinteger(L, cn->depth);
+        lua_setfield(L, -2, "depth");
+        lua_pushinteger(L, cn->callnb);
+        lua_setfield(L, -2, "callnb");
+        lua_pushinteger(L, __clock_tons(&pc->clock, cn->total_nspan));
+        lua_setfield(L, -2, "total_nspan");
+        lua_pushinteger(L, __clock_tons(&pc->clock, cn->real_nspan));
+        lua_setfield(L, -2, "real_nspan");
+        if(i == LP_CCT_TRUNCATED){
+            lua_pushstring(L, "[truncated]");
+            lua_setfield(L, -2, "name");
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
 
     return 1;
 }
 
+/* 旧的上下文要等gc才释放，先把定时器停掉、hook摘干净，免得信号和hook再碰到它 */
 static int preset(lua_State *L){
+    ProfileContext *pc = __profilecontext_get(L);
+    lua_State *co;
+
+    if(pc){
+        __timer_stop(&pc->timer);
+
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &LPROFILE_THREADSKEY);
+        if(!lua_isnil(L, -1)){
+            lua_pushnil(L);
+            while(lua_next(L, -2)){
+                co = lua_tothread(L, -2);
+                if(co){
+                    lua_sethook(co, NULL, 0, 0);
+                }
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+
+        lua_pushnil(L);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &LPROFILE_THREADSKEY);
+    }
+
     lua_pushnil(L);
-    lua_setfield(L, LUA_REGISTRYINDEX, LPROFILE_REGKEY_NAME);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &LPROFILE_REGKEY);
     return 0;
 }
 
 static int pinfo(lua_State *L){
     ProfileContext *pc = __profilecontext_getorcreate(L);
 
+    __clock_calibrate(&pc->clock);
+
     lua_newtable(L);
 
     lua_pushinteger(L, pc->stacks.usednb);
     lua_setfield(L, -2, "stackpoolusednb");
     lua_pushinteger(L, pc->stacks.freenb);
     lua_setfield(L, -2, "stackpoolfreenb");
+    lua_pushinteger(L, pc->stacks.runningnb);
+    lua_setfield(L, -2, "stackpoolrunningnb");
     lua_pushinteger(L, pc->records.cap);
     lua_setfield(L, -2, "recordpoolcap");
     lua_pushinteger(L, pc->records.nb);
     lua_setfield(L, -2, "recordpoolnb");
+    lua_pushinteger(L, pc->records.dirtynb);
+    lua_setfield(L, -2, "recordpooldirtynb");
     lua_pushinteger(L, pc->stacks.stat_usednb);
     lua_setfield(L, -2, "stackpoolstatusednb");
-    lua_pushinteger(L, pc->stat_lossnspan);
+    lua_pushinteger(L, LP_STACK_MINCAP << pc->stacks.sizehint);
+    lua_setfield(L, -2, "stackpoolsizehint");
+    lua_pushinteger(L, __clock_tons(&pc->clock, pc->stat_lossnspan));
     lua_setfield(L, -2, "stat_lossnspan");
-    lua_pushinteger(L, pc->stat_realnspan);
+    lua_pushinteger(L, __clock_tons(&pc->clock, pc->stat_realnspan));
     lua_setfield(L, -2, "stat_realnspan");
     lua_pushboolean(L, pc->enabled ? 1 : 0);
     lua_setfield(L, -2, "enabled");
@@ -797,8 +3647,94 @@ static int pinfo(lua_State *L){
     lua_setfield(L, -2, "proto_yield");
     lua_pushboolean(L, pc->trace_tailcall ? 1 : 0);
     lua_setfield(L, -2, "trace_tailcall");
-    lua_pushinteger(L, pc->stat_yieldnspan);
+    lua_pushboolean(L, pc->capture_name ? 1 : 0);
+    lua_setfield(L, -2, "capture_name");
+    lua_pushinteger(L, __clock_tons(&pc->clock, pc->stat_yieldnspan));
     lua_setfield(L, -2, "stat_yieldnspan");
+    lua_pushinteger(L, pc->stat_eventnb);
+    lua_setfield(L, -2, "stat_eventnb");
+    lua_pushinteger(L, pc->stat_samplenb);
+    lua_setfield(L, -2, "stat_samplenb");
+    lua_pushstring(L, lp_mode_names[pc->mode]);
+    lua_setfield(L, -2, "mode");
+    lua_pushinteger(L, pc->sample_every);
+    lua_setfield(L, -2, "sample_every");
+    lua_pushinteger(L, pc->timer.hz);
+    lua_setfield(L, -2, "timer_hz");
+    lua_pushstring(L, lp_timer_names[pc->timer.clock]);
+    lua_setfield(L, -2, "timer_clock");
+    lua_pushboolean(L, pc->timer.active ? 1 : 0);
+    lua_setfield(L, -2, "timer_active");
+    lua_pushboolean(L, pc->compensate ? 1 : 0);
+    lua_setfield(L, -2, "compensate");
+    lua_pushboolean(L, pc->filter.enabled ? 1 : 0);
+    lua_setfield(L, -2, "filter");
+
+    lua_newtable(L);
+    for(int i = 0; i < LP_MEM_NB; ++i){
+        lua_pushinteger(L, pc->mem.accounts[i].used);
+        lua_setfield(L, -2, lp_mem_names[i]);
+    }
+    lua_pushinteger(L, pc->mem.total);
+    lua_setfield(L, -2, "total");
+    lua_pushinteger(L, pc->mem.budget);
+    lua_setfield(L, -2, "budget");
+    lua_pushinteger(L, pc->records.stat_dropnb);
+    lua_setfield(L, -2, "dropnb");
+    lua_pushinteger(L, pc->edges.stat_dropnb);
+    lua_setfield(L, -2, "edgedropnb");
+    lua_pushinteger(L, pc->records.stat_linedropnb);
+    lua_setfield(L, -2, "linedropnb");
+    lua_pushinteger(L, pc->records.stat_histdropnb);
+    lua_setfield(L, -2, "histdropnb");
+    lua_setfield(L, -2, "mem");
+
+    lua_newtable(L);
+    for(int evt = 0; evt < LP_EVT_NB; ++evt){
+        OverheadContext *oc = &pc->overhead;
+
+        lua_newtable(L);
+        lua_pushinteger(L, __clock_tons(&pc->clock, oc->unmeasured[evt]));
+        lua_setfield(L, -2, "unmeasured");
+        lua_pushinteger(L, __clock_tons(&pc->clock, __overhead_median(oc, evt)));
+        lua_setfield(L, -2, "median");
+
+        lua_newtable(L);
+        for(int i = 0, n = 0; i < LP_OVERHEAD_BUCKETNB; ++i){
+            if(oc->hist[evt][i] > 0){
+                lua_newtable(L);
+                lua_pushinteger(L, i > 0 ? __clock_tons(&pc->clock, (uint64_t)1 << i) : 0);
+                lua_setfield(L, -2, "lo");
+                lua_pushinteger(L, oc->hist[evt][i]);
+                lua_setfield(L, -2, "nb");
+                lua_rawseti(L, -2, ++n);
+            }
+        }
+        lua_setfield(L, -2, "hist");
+
+        lua_setfield(L, -2, lp_evt_names[evt]);
+    }
+    lua_setfield(L, -2, "overhead");
+    lua_pushstring(L, lp_clock_names[pc->clock.source]);
+    lua_setfield(L, -2, "clock");
+    lua_pushnumber(L, pc->clock.nspertick);
+    lua_setfield(L, -2, "clock_nspertick");
+    lua_pushstring(L, lp_agg_names[pc->records.aggregate]);
+    lua_setfield(L, -2, "aggregate");
+    lua_pushboolean(L, pc->graph ? 1 : 0);
+    lua_setfield(L, -2, "graph");
+    lua_pushinteger(L, pc->edges.nb);
+    lua_setfield(L, -2, "edgenb");
+    lua_pushboolean(L, pc->cct.enabled ? 1 : 0);
+    lua_setfield(L, -2, "cct");
+    lua_pushinteger(L, pc->cct.nb);
+    lua_setfield(L, -2, "cctnodenb");
+    lua_pushinteger(L, pc->cct.stat_truncnb);
+    lua_setfield(L, -2, "cct_truncnb");
+    lua_pushboolean(L, pc->line.sample ? 1 : 0);
+    lua_setfield(L, -2, "line_sample");
+    lua_pushinteger(L, pc->records.histafter < INT_MAX ? pc->records.histafter : 0);
+    lua_setfield(L, -2, "hist_threshold");
 
     return 1;
 }
@@ -819,6 +3755,8 @@ static int pdisable(lua_State *L){
 
 static int psetyieldproto(lua_State *L){
     void *yield;
+    void *key;
+    lua_Debug dbg;
     ProfileContext *pc;
 
     if(lua_isnoneornil(L, 1)){
@@ -827,8 +3765,28 @@ static int psetyieldproto(lua_State *L){
         yield = (void *)lua_topointer(L, 1);
     }
 
+#if !LP_ENABLE_YIELD
+    if(yield){
+        return luaL_error(L, "yield tracking is disabled at build time");
+    }
+#endif
+
     pc = __profilecontext_getorcreate(L);
+    key = yield;
+    if(lua_iscfunction(L, 1)){
+        key = (void *)lua_tocfunction(L, 1);
+    }else if(lua_isfunction(L, 1)){
+        lua_pushvalue(L, 1);
+        lua_getinfo(L, ">S", &dbg);
+        key = __recordpool_protokey(&pc->records, dbg.source, dbg.linedefined);
+        if(!key){
+            return luaL_error(L, "can not intern yield source");
+        }
+    }
+
     pc->proto_yield = yield;
+    pc->proto_yieldkey = key;
+    __profilecontext_refreshhook(L, pc);
 
     return 0;
 }
@@ -851,12 +3809,392 @@ static int ptracetailcall(lua_State *L){
         val = (bool)lua_toboolean(L, 1);
     }
 
+#if !LP_ENABLE_TRACETAILCALL
+    if(val){
+        return luaL_error(L, "tailcall tracing is disabled at build time");
+    }
+#endif
+
     pc = __profilecontext_getorcreate(L);
+    if(pc->stacks.runningnb > 0 && pc->trace_tailcall != val){
+        return luaL_error(L, "can not change tailcall tracing while profiling");
+    }
+
     pc->trace_tailcall = val;
 
     return 0;
 }
 
+static int pgraph(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    pc->graph = lua_isnoneornil(L, 1) ? false : (bool)lua_toboolean(L, 1);
+
+    return 0;
+}
+
+/* pcct{maxnodes=, maxdepth=}打开调用上下文树，pcct(false)关掉 */
+static int pcct(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    CctContext *cc = &pc->cct;
+    bool enabled = true;
+    lua_Integer maxnodes = cc->maxnodes;
+    lua_Integer maxdepth = cc->maxdepth;
+
+    if(lua_istable(L, 1)){
+        lua_getfield(L, 1, "maxnodes");
+        maxnodes = luaL_optinteger(L, -1, maxnodes);
+        lua_getfield(L, 1, "maxdepth");
+        maxdepth = luaL_optinteger(L, -1, maxdepth);
+        lua_pop(L, 2);
+    }else{
+        enabled = lua_isnone(L, 1) || lua_toboolean(L, 1);
+    }
+
+    luaL_argcheck(L, maxnodes > LP_CCT_TRUNCATED && maxnodes <= INT_MAX, 1, "maxnodes out of range");
+    luaL_argcheck(L, maxdepth > 0 && maxdepth <= INT_MAX, 1, "maxdepth out of range");
+
+    if(pc->stacks.runningnb > 0){
+        return luaL_error(L, "can not change cct while profiling");
+    }
+
+    cc->enabled = enabled;
+    cc->maxnodes = (int)maxnodes;
+    cc->maxdepth = (int)maxdepth;
+    __cct_reset(L, cc);
+
+    if(enabled && cc->nb <= LP_CCT_TRUNCATED){
+        cc->enabled = false;
+        return luaL_error(L, "can not allocate cct");
+    }
+
+    return 0;
+}
+
+static int phist(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    lua_Integer after;
+
+    if(lua_isboolean(L, 1) && !lua_toboolean(L, 1)){
+        rp->histafter = INT_MAX;
+        __recordpool_freehists(rp);
+        return 0;
+    }
+
+    after = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, after > 0 && after < INT_MAX, 1, "threshold out of range");
+    rp->histafter = (int)after;
+    return 0;
+}
+
+static int pcapturename(lua_State *L){
+    bool val;
+    ProfileContext *pc;
+
+    if(lua_isnoneornil(L, 1)){
+        val = false;
+    }else{
+        val = (bool)lua_toboolean(L, 1);
+    }
+
+#if !LP_ENABLE_CAPTURENAME
+    if(val){
+        return luaL_error(L, "name capture is disabled at build time");
+    }
+#endif
+
+    pc = __profilecontext_getorcreate(L);
+    pc->capture_name = val;
+    __profilecontext_refreshhook(L, pc);
+
+    return 0;
+}
+
+/* pfilter{include={pattern...}, exclude={pattern...}, exclude_c=bool}，pattern匹配source；pfilter()取消过滤 */
+static int pfilter(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    FilterContext fc;
+
+    memset(&fc, 0, sizeof(fc));
+
+    if(lua_isnoneornil(L, 1)){
+        lua_pushnil(L);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &LPROFILE_FILTERKEY);
+    }else{
+        static const char *const fields[] = {"include", "exclude"};
+        int nbs[2];
+
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_newtable(L);
+
+        lua_getglobal(L, "string");
+        if(lua_istable(L, -1)){
+            lua_getfield(L, -1, "find");
+            lua_setfield(L, -3, "find");
+        }
+        lua_pop(L, 1);
+
+        for(int f = 0; f < 2; ++f){
+            int nb = 0;
+
+            lua_newtable(L);
+            lua_getfield(L, 1, fields[f]);
+            if(!lua_isnil(L, -1)){
+                luaL_checktype(L, -1, LUA_TTABLE);
+                for(int i = 1; i <= (int)lua_rawlen(L, -1); ++i){
+                    lua_rawgeti(L, -1, i);
+                    if(!lua_isstring(L, -1)){
+                        return luaL_error(L, "pfilter %s[%d] is not a string", fields[f], i);
+                    }
+                    lua_rawseti(L, -3, ++nb);
+                }
+            }
+            lua_pop(L, 1);
+            lua_setfield(L, -2, fields[f]);
+            nbs[f] = nb;
+        }
+
+        lua_getfield(L, -1, "find");
+        if(!lua_isfunction(L, -1) && (nbs[0] > 0 || nbs[1] > 0)){
+            return luaL_error(L, "pfilter needs string.find");
+        }
+        lua_pop(L, 1);
+
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &LPROFILE_FILTERKEY);
+
+        lua_getfield(L, 1, "exclude_c");
+        fc.exclude_c = (bool)lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        fc.includenb = nbs[0];
+        fc.excludenb = nbs[1];
+        fc.enabled = fc.exclude_c || fc.includenb > 0 || fc.excludenb > 0;
+    }
+
+    pc->filter = fc;
+
+    for(int i = 0; i < pc->records.nb; ++i){
+        pc->records.pool[i].filtered = -1;
+    }
+
+    return 0;
+}
+
+static void __pinternals_pushmap(lua_State *L, ImapContext *mc, const char *name){
+    ImapStats st;
+
+    imap_stats(mc, &st);
+
+    lua_newtable(L);
+    lua_pushinteger(L, st.cap);
+    lua_setfield(L, -2, "cap");
+    lua_pushinteger(L, st.count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, st.cap ? (double)st.count / st.cap : 0.0);
+    lua_setfield(L, -2, "load");
+    lua_pushinteger(L, st.maxprobe);
+    lua_setfield(L, -2, "maxprobe");
+    lua_pushinteger(L, st.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushstring(L, lp_hash_names[mc->hash]);
+    lua_setfield(L, -2, "hash");
+
+    lua_newtable(L);
+    for(int i = 0; i < IMAP_PROBEHIST_NB; ++i){
+        if(st.probehist[i] > 0){
+            lua_pushinteger(L, st.probehist[i]);
+            lua_rawseti(L, -2, (lua_Integer)1 << i);
+        }
+    }
+    lua_setfield(L, -2, "probehist");
+
+    lua_setfield(L, -2, name);
+}
+
+static int pinternals(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    lua_newtable(L);
+    __pinternals_pushmap(L, &pc->stacks.usedmap, "stacks");
+    __pinternals_pushmap(L, &pc->records.usedmap, "records");
+    __pinternals_pushmap(L, &pc->records.keymap, "keys");
+    __pinternals_pushmap(L, &pc->records.strs.map, "strings");
+    __pinternals_pushmap(L, &pc->edges.map, "edges");
+    __pinternals_pushmap(L, &pc->cct.map, "cct");
+
+    return 1;
+}
+
+static int psethash(lua_State *L){
+    int hash = luaL_checkoption(L, 1, NULL, lp_hash_names);
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    pc->maphash = hash;
+    imap_sethash(&pc->stacks.usedmap, hash);
+    imap_sethash(&pc->records.usedmap, hash);
+    imap_sethash(&pc->records.keymap, hash);
+    imap_sethash(&pc->records.srcmap, hash);
+    imap_sethash(&pc->records.strs.map, hash);
+    imap_sethash(&pc->edges.map, hash);
+    imap_sethash(&pc->cct.map, hash);
+
+    return 0;
+}
+
+/* preserve{stacks=, depth=, records=, edges=}预先分配，之后profile和pclear都不再分配 */
+static int preserve(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    lua_Integer stacks;
+    lua_Integer depth;
+    lua_Integer records;
+    lua_Integer edges;
+
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    lua_getfield(L, 1, "stacks");
+    stacks = luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "depth");
+    depth = luaL_optinteger(L, -1, LP_STACK_MINCAP);
+    lua_getfield(L, 1, "records");
+    records = luaL_optinteger(L, -1, 0);
+    lua_getfield(L, 1, "edges");
+    edges = luaL_optinteger(L, -1, 0);
+    lua_pop(L, 4);
+
+    luaL_argcheck(L, stacks >= 0 && stacks <= INT_MAX, 1, "stacks out of range");
+    luaL_argcheck(L, depth > 0 && depth <= (LP_STACK_MINCAP << (LP_STACK_CLASSNB - 1)), 1, "depth out of range");
+    luaL_argcheck(L, records >= 0 && records <= INT_MAX, 1, "records out of range");
+    luaL_argcheck(L, edges >= 0 && edges <= INT_MAX, 1, "edges out of range");
+
+    if(!__callstackpool_reserve(L, &pc->stacks, (int)stacks, (int)depth)){
+        return luaL_error(L, "can not reserve call stacks");
+    }
+
+    if(records > rp->cap && !__recordpool_resize(rp, (int)records)){
+        return luaL_error(L, "can not reserve records");
+    }
+
+    if(!imap_reserve(&rp->usedmap, records) || !imap_reserve(&rp->keymap, records)
+            || !imap_reserve(&rp->srcmap, records) || !istr_reserve(&rp->strs, records * 2)){
+        return luaL_error(L, "can not reserve record maps");
+    }
+
+    if(edges > pc->edges.cap && !__edgepool_resize(&pc->edges, (int)edges)){
+        return luaL_error(L, "can not reserve edges");
+    }
+
+    if(!imap_reserve(&pc->edges.map, edges)){
+        return luaL_error(L, "can not reserve edge map");
+    }
+
+    return 0;
+}
+
+static int ptrim(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+    RecordPool *rp = &pc->records;
+    size_t before = pc->mem.total;
+
+    __callstackpool_trim(L, &pc->stacks);
+
+    if(rp->cap > rp->nb){
+        __recordpool_resize(rp, rp->nb);
+    }
+
+    imap_trim(&rp->usedmap);
+    imap_trim(&rp->keymap);
+    imap_trim(&rp->srcmap);
+    imap_trim(&rp->strs.map);
+
+    if(pc->edges.cap > pc->edges.nb){
+        __edgepool_resize(&pc->edges, pc->edges.nb);
+    }
+
+    imap_trim(&pc->edges.map);
+
+    if(pc->cct.cap > pc->cct.nb){
+        __cct_resize(&pc->cct, pc->cct.nb);
+    }
+
+    imap_trim(&pc->cct.map);
+
+    lua_pushinteger(L, before > pc->mem.total ? before - pc->mem.total : 0);
+    return 1;
+}
+
+static int psetmemlimit(lua_State *L){
+    lua_Integer budget = luaL_optinteger(L, 1, 0);
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    luaL_argcheck(L, budget >= 0, 1, "memory limit must be non-negative");
+    pc->mem.budget = (size_t)budget;
+
+    return 0;
+}
+
+static int psetclock(lua_State *L){
+    int source = luaL_checkoption(L, 1, NULL, lp_clock_names);
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+#if !LP_HAVE_TSC
+    if(source == LP_CLOCK_TSC){
+        return luaL_error(L, "tsc clock is not supported on this platform");
+    }
+#endif
+
+    if(pc->stacks.runningnb > 0){
+        return luaL_error(L, "can not change clock while profiling");
+    }
+
+    if(source != pc->clock.source){
+        __profilecontext_clear(L, pc);
+        __clock_init(&pc->clock);
+        __overhead_init(&pc->overhead);
+        pc->clock.source = source;
+    }
+
+    return 0;
+}
+
+static int psetaggregate(lua_State *L){
+    int aggregate = luaL_checkoption(L, 1, NULL, lp_agg_names);
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    if(pc->stacks.runningnb > 0){
+        return luaL_error(L, "can not change aggregation while profiling");
+    }
+
+    if(aggregate != pc->records.aggregate){
+        __profilecontext_clear(L, pc);
+        __recordpool_reset(L, &pc->records);
+        __cct_reset(L, &pc->cct);
+        pc->records.aggregate = aggregate;
+        pc->line.id = -1;
+        pc->line.lastkey = NULL;
+        pc->line.lastid = -1;
+    }
+
+    return 0;
+}
+
+static int pgetaggregate(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    lua_pushstring(L, lp_agg_names[pc->records.aggregate]);
+
+    return 1;
+}
+
+static int pgetclock(lua_State *L){
+    ProfileContext *pc = __profilecontext_getorcreate(L);
+
+    lua_pushstring(L, lp_clock_names[pc->clock.source]);
+
+    return 1;
+}
+
 int luaopen_lprofile_c(lua_State *L){
     luaL_checkversion(L);
 
@@ -865,6 +4203,14 @@ int luaopen_lprofile_c(lua_State *L){
         {"pend", pend},
         {"pclear", pclear},
         {"pdump", pdump},
+        {"pdumpgraph", pdumpgraph},
+        {"pdumplines", pdumplines},
+        {"pdumpbin", pdumpbin},
+        {"pdumpdelta", pdumpdelta},
+        {"ptop", ptop},
+        {"pcursor", pcursor},
+        {"pdumpcct", pdumpcct},
+        {"pdumpfolded", pdumpfolded},
         {"preset", preset},
         {"pinfo", pinfo},
         {"penable", penable},
@@ -872,13 +4218,23 @@ int luaopen_lprofile_c(lua_State *L){
         {"psetyieldproto", psetyieldproto},
         {"pgetyieldproto", pgetyieldproto},
         {"ptracetailcall", ptracetailcall},
+        {"pcapturename", pcapturename},
+        {"pgraph", pgraph},
+        {"pcct", pcct},
+        {"phist", phist},
+        {"pfilter", pfilter},
+        {"pinternals", pinternals},
+        {"psethash", psethash},
+        {"psetmemlimit", psetmemlimit},
+        {"preserve", preserve},
+        {"ptrim", ptrim},
+        {"psetclock", psetclock},
+        {"pgetclock", pgetclock},
+        {"psetaggregate", psetaggregate},
+        {"pgetaggregate", pgetaggregate},
         {NULL, NULL},
     };
 
     luaL_newlib(L, lib);
     return 1;
 }
-
-
-
-
@@ -0,0 +1,94 @@
+-- 开销补偿的检查：父函数几乎没有自身耗时，只是不停调用子函数，
+-- 补偿后父函数的inclusive不能比子函数短，self也不能是负数(dump出来是无符号的，按有符号看)。
+-- 在仓库根目录编出lprofile_c.so后运行，失败时退出码非0：
+--   LUA_CPATH="./?.so" lua test/compensatetest.lua [calls]
+local lp = require "lprofile_c"
+
+local CALLS = tonumber(arg and arg[1]) or 200000
+
+local function leaf(x)
+    return x
+end
+
+local function child(x)
+    local y = leaf(x)
+    return y
+end
+
+local function parent(n)
+    local f = child
+    for i = 1, n do
+        f(i)
+    end
+end
+
+-- 追踪尾调用时tail和child在同一次ret里结束，一并检查；不追踪时tail的frame被child覆盖，没有自己的记录
+local function tailchild(x)
+    return x + 1
+end
+
+local function tail(x)
+    return tailchild(x)
+end
+
+local function tailparent(n)
+    local f = tail
+    for i = 1, n do
+        f(i)
+    end
+end
+
+local function find(records, fn)
+    local line = debug.getinfo(fn, "S").linedefined
+    for _, r in pairs(records) do
+        if r.line == line then
+            return r
+        end
+    end
+    error("no record for function at line " .. line)
+end
+
+local function check(records, outer, inner, what)
+    local o = find(records, outer)
+    local i = find(records, inner)
+
+    assert(o.total_nspan >= i.total_nspan,
+        string.format("%s: parent inclusive %d < child inclusive %d", what, o.total_nspan, i.total_nspan))
+    for _, r in ipairs({o, i}) do
+        assert(r.real_nspan >= 0 and r.real_nspan <= r.total_nspan,
+            string.format("%s: bad self %d of total %d at line %d", what, r.real_nspan, r.total_nspan, r.line))
+    end
+end
+
+local function run(tailcall)
+    lp.pclear()
+    if lp.ptracetailcall then
+        lp.ptracetailcall(tailcall)
+    end
+    lp.pbegin{mode = "trace", compensate = true}
+    parent(CALLS)
+    tailparent(CALLS)
+    lp.pend()
+
+    local records = lp.pdump()
+    local what = tailcall and "tailcall" or "plain"
+    check(records, parent, child, what)
+    check(records, child, leaf, what)
+    if tailcall then
+        check(records, tailparent, tail, what)
+        check(records, tail, tailchild, what)
+    end
+end
+
+local ok, err = pcall(function()
+    run(false)
+    run(true)
+end)
+lp.ptracetailcall(false)
+
+if not ok then
+    print("FAIL " .. tostring(err))
+    os.exit(1)
+end
+
+print("ok")